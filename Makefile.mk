@@ -40,6 +40,29 @@ BASE_FLAGS += -DNDEBUG $(BASE_OPTS) -fvisibility=hidden
 CXXFLAGS   += -fvisibility-inlines-hidden
 endif
 
+# Compact tape formats: TAPE_FORMAT=int16 or TAPE_FORMAT=half
+ifeq ($(TAPE_FORMAT),int16)
+BASE_FLAGS += -DTAPE_INT16
+endif
+ifeq ($(TAPE_FORMAT),half)
+BASE_FLAGS += -DTAPE_HALF
+endif
+
+# Interleaved stereo tape, both channels share cache lines: TAPE_LAYOUT=interleaved
+ifeq ($(TAPE_LAYOUT),interleaved)
+BASE_FLAGS += -DTAPE_INTERLEAVED
+endif
+
+# Process-wide tape pool shared by all instances: TAPE_POOL=true
+ifeq ($(TAPE_POOL),true)
+BASE_FLAGS += -DTAPE_POOL
+endif
+
+# Tapes mapped on huge pages, locked and faulted in ahead: TAPE_LOCKED=true
+ifeq ($(TAPE_LOCKED),true)
+BASE_FLAGS += -DTAPE_LOCKED
+endif
+
 BUILD_C_FLAGS   = $(BASE_FLAGS) -std=c99 -std=gnu99 $(CFLAGS) $(CPPFLAGS)
 BUILD_CXX_FLAGS = $(BASE_FLAGS) -std=c++11 $(CXXFLAGS) $(CPPFLAGS)
 
@@ -0,0 +1,670 @@
+/**
+    Bollie Delay - (c) 2016 Thomas Ebeling https://ca9.eu
+
+    This file is part of bolliedelay.lv2
+
+    This is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This code is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+* \file bench.c
+* \author Bollie (https://ca9.eu)
+* \brief Offline benchmark driver for the delay.
+*
+* Runs the plugin through lv2_descriptor() like a minimal host and times
+* run() over a grid of scenarios, sample rates and block sizes. Every line
+* reports the cost in ns per stereo sample and how many instances a single
+* core could run in real time.
+*
+* With -w, every scenario renders fixed stimuli instead and the outputs are
+* stored as reference files. With -c, the same renders are compared against
+* those references, so a faster kernel can be checked against the scalar
+* one. A render passes if no output sample differs by more than the
+* tolerance, which is BENCH_TOLERANCE (about -100 dBFS) unless given by -e.
+* References depend on the rate and block size, both default to 48 kHz and
+* 128 samples in these modes.
+*
+* Usage: bollie-bench [-t seconds] [-r rate] [-b block] [-w dir | -c dir]
+*       [-e tolerance] [scenario ...]
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "lv2/lv2plug.in/ns/lv2core/lv2.h"
+#include "lv2/lv2plug.in/ns/ext/atom/atom.h"
+#include "lv2/lv2plug.in/ns/ext/buf-size/buf-size.h"
+#include "lv2/lv2plug.in/ns/ext/options/options.h"
+#include "lv2/lv2plug.in/ns/ext/time/time.h"
+#include "lv2/lv2plug.in/ns/ext/urid/urid.h"
+
+#define BENCH_PORTS 38          ///< control ports, the load ports stay off
+#define BENCH_SEQ_SIZE 256      ///< bytes for the control port sequence
+#define BENCH_WARMUP 0.5        ///< seconds run before timing starts
+#define BENCH_URIS 64           ///< number of URIs the map can hold
+#define BENCH_RENDER_TIME 3     ///< seconds rendered for the references
+#define BENCH_TOLERANCE 1e-5    ///< largest sample difference that passes
+
+/**
+* Port indices used by the driver, as declared in bolliedelay.ttl
+*/
+typedef enum {
+    PORT_TEMPO_HOST = 0,
+    PORT_TEMPO_USER = 1,
+    PORT_TEMPO_MODE = 2,
+    PORT_TAP        = 3,
+    PORT_MIX        = 4,
+    PORT_FEEDBACK   = 5,
+    PORT_CROSSF     = 6,
+    PORT_LOW_ON     = 7,
+    PORT_LOW_F      = 8,
+    PORT_LOW_Q      = 9,
+    PORT_HIGH_ON    = 10,
+    PORT_HIGH_F     = 11,
+    PORT_HIGH_Q     = 12,
+    PORT_DIV_L      = 13,
+    PORT_DIV_R      = 14,
+    PORT_INPUT_L    = 15,
+    PORT_INPUT_R    = 16,
+    PORT_OUTPUT_L   = 17,
+    PORT_OUTPUT_R   = 18,
+    PORT_CONTROL    = 20,
+    PORT_INTERP     = 22,
+    PORT_HEAD_DIV   = 23,
+    PORT_HEAD_GAIN  = 24,
+    PORT_HEAD_PAN   = 25,
+    PORT_LOAD_AVG   = 32,
+    PORT_LOAD_PEAK  = 33,
+    PORT_WET_RATE   = 34,
+    PORT_MOD_DEPTH  = 35,
+    PORT_MOD_RATE   = 36,
+    PORT_MOD_SHAPE  = 37,
+} BenchPort;
+
+/**
+* Port defaults from bolliedelay.ttl, audio and atom ports are left out
+*/
+static const float port_defaults[BENCH_PORTS] = {
+    120, 120, 0, 0, 30, 40, 20, 0, 20, 1, 0, 7500, 1, 0, 0,
+    0, 0, 0, 0, 120, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0.8, 0,
+};
+
+/**
+* State of the minimal host around one plugin instance
+*/
+typedef struct bhost {
+    const LV2_Descriptor* desc;
+    LV2_Handle  handle;
+    double      rate;
+    uint32_t    block;              ///< block size of every run() call
+    uint64_t    frame;              ///< frames rendered since activation
+    float       ports[BENCH_PORTS]; ///< control port values
+    uint64_t    seq[BENCH_SEQ_SIZE / sizeof(uint64_t)]; ///< control events
+    float*      in_l;
+    float*      in_r;
+    float*      out_l;
+    float*      out_r;
+    uint32_t    noise;              ///< state of the noise generator
+    void        (*input)(struct bhost* host, uint32_t n_samples);
+} BenchHost;
+
+/**
+* A benchmark scenario
+*/
+typedef struct {
+    const char* name;
+    const char* info;
+    bool        silent;                         ///< feed digital silence
+    void        (*setup)(BenchHost* host);      ///< sets the ports once
+    void        (*block)(BenchHost* host);      ///< called before run()
+} BenchScenario;
+
+static char* uris[BENCH_URIS];
+static uint32_t n_uris = 0;
+
+/**
+* Maps URIs to the position in a small table.
+*/
+static LV2_URID map_uri(LV2_URID_Map_Handle handle, const char* uri) {
+    for (uint32_t i = 0 ; i < n_uris ; ++i)
+        if (!strcmp(uris[i], uri))
+            return i + 1;
+    if (n_uris == BENCH_URIS)
+        return 0;
+    uris[n_uris] = strdup(uri);
+    return ++n_uris;
+}
+
+static LV2_URID_Map urid_map = { NULL, map_uri };
+
+/**
+* Empties the control port sequence.
+*/
+static void seq_clear(BenchHost* host) {
+    LV2_Atom_Sequence* seq = (LV2_Atom_Sequence*)host->seq;
+    seq->atom.type = map_uri(NULL, LV2_ATOM__Sequence);
+    seq->atom.size = sizeof(LV2_Atom_Sequence_Body);
+    seq->body.unit = 0;
+    seq->body.pad = 0;
+}
+
+/**
+* Appends a time:Position event with a new host tempo to the control port
+* sequence.
+* \param host   host state
+* \param frames offset of the event in the block
+* \param bpm    beats per minute
+*/
+static void seq_tempo(BenchHost* host, int64_t frames, float bpm) {
+    LV2_Atom_Sequence* seq = (LV2_Atom_Sequence*)host->seq;
+    LV2_Atom_Event* ev = (LV2_Atom_Event*)
+        ((uint8_t*)&seq->body + seq->atom.size);
+    LV2_Atom_Object* obj = (LV2_Atom_Object*)&ev->body;
+    LV2_Atom_Property_Body* prop = (LV2_Atom_Property_Body*)(obj + 1);
+
+    ev->time.frames = frames;
+    obj->atom.type = map_uri(NULL, LV2_ATOM__Object);
+    obj->atom.size = sizeof(LV2_Atom_Object_Body)
+        + sizeof(LV2_Atom_Property_Body) + sizeof(uint64_t);
+    obj->body.id = 0;
+    obj->body.otype = map_uri(NULL, LV2_TIME__Position);
+    prop->key = map_uri(NULL, LV2_TIME__beatsPerMinute);
+    prop->context = 0;
+    prop->value.type = map_uri(NULL, LV2_ATOM__Float);
+    prop->value.size = sizeof(float);
+    *(float*)(prop + 1) = bpm;
+    seq->atom.size += sizeof(LV2_Atom_Event)
+        + ((obj->atom.size + 7) & ~7);
+}
+
+/**
+* Fills the input buffers with bursts of noise, so the tape sees signal
+* and the tails decay in between.
+*/
+static void input_noise(BenchHost* host, uint32_t n_samples) {
+    const uint64_t burst = (uint64_t)(0.05 * host->rate);
+    const uint64_t period = (uint64_t)(0.5 * host->rate);
+    for (uint32_t i = 0 ; i < n_samples ; ++i) {
+        host->noise = host->noise * 1664525 + 1013904223;
+        float v = (int32_t)host->noise / 4294967296.f;
+        if ((host->frame + i) % period >= burst)
+            v = 0;
+        host->in_l[i] = v;
+        host->in_r[i] = -v;
+    }
+}
+
+/**
+* Fills the input buffers with one impulse per channel.
+*/
+static void input_impulse(BenchHost* host, uint32_t n_samples) {
+    const uint64_t at_l = (uint64_t)(0.1 * host->rate);
+    const uint64_t at_r = (uint64_t)(0.15 * host->rate);
+    for (uint32_t i = 0 ; i < n_samples ; ++i) {
+        host->in_l[i] = host->frame + i == at_l ? 1 : 0;
+        host->in_r[i] = host->frame + i == at_r ? 0.5 : 0;
+    }
+}
+
+/**
+* Fills the input buffers with an exponential sine sweep from 20 Hz to
+* 20 kHz over two seconds, the right channel in quadrature.
+*/
+static void input_sweep(BenchHost* host, uint32_t n_samples) {
+    const double T = 2;
+    const double k = log(20000. / 20.);
+    for (uint32_t i = 0 ; i < n_samples ; ++i) {
+        const double t = (host->frame + i) / host->rate;
+        const double phase = t < T 
+            ? 2 * M_PI * 20 * T / k * (exp(t / T * k) - 1) : 0;
+        host->in_l[i] = t < T ? 0.5 * sin(phase) : 0;
+        host->in_r[i] = t < T ? 0.5 * cos(phase) : 0;
+    }
+}
+
+/**
+* Input stimulus for the reference renders
+*/
+typedef struct {
+    const char* name;
+    void        (*input)(BenchHost* host, uint32_t n_samples);
+} BenchStimulus;
+
+static const BenchStimulus stimuli[] = {
+    { "impulse",    input_impulse },
+    { "sweep",      input_sweep },
+    { "noise",      input_noise },
+};
+
+#define N_STIMULI (sizeof(stimuli) / sizeof(stimuli[0]))
+
+static void setup_filters(BenchHost* host) {
+    host->ports[PORT_LOW_ON] = 1;
+    host->ports[PORT_LOW_F] = 300;
+    host->ports[PORT_LOW_Q] = 2;
+    host->ports[PORT_HIGH_ON] = 1;
+    host->ports[PORT_HIGH_F] = 3000;
+    host->ports[PORT_HIGH_Q] = 0.7;
+}
+
+static void block_sweep(BenchHost* host) {
+    // Triangle sweeps over about one second
+    const double t = host->frame / host->rate;
+    const double tri = 2 * (t - (int64_t)t);
+    const double x = tri < 1 ? tri : 2 - tri;
+    host->ports[PORT_LOW_F] = 20 + 1000 * x;
+    host->ports[PORT_HIGH_F] = 12000 - 10000 * x;
+}
+
+static void setup_tempo(BenchHost* host) {
+    host->ports[PORT_TEMPO_MODE] = 0;    // follow the host
+    host->ports[PORT_DIV_L] = 1;
+    host->ports[PORT_DIV_R] = 3;
+}
+
+static void block_tempo(BenchHost* host) {
+    // A new host tempo about four times a second
+    const uint64_t step = (uint64_t)(0.25 * host->rate);
+    if (host->frame / step != (host->frame + host->block) / step)
+        seq_tempo(host, 0, (host->frame / step) % 2 ? 90 : 140);
+}
+
+static void setup_feedback(BenchHost* host) {
+    host->ports[PORT_FEEDBACK] = 100;
+    host->ports[PORT_CROSSF] = 50;
+    host->ports[PORT_MIX] = 50;
+    host->ports[PORT_INTERP] = 1;
+}
+
+static void setup_heads(BenchHost* host) {
+    for (uint32_t i = 0 ; i < 3 ; ++i) {
+        host->ports[PORT_HEAD_DIV + 3 * i] = i + 1;
+        host->ports[PORT_HEAD_GAIN + 3 * i] = 50;
+        host->ports[PORT_HEAD_PAN + 3 * i] = (float)i * 50.f - 50.f;
+    }
+}
+
+static void setup_decimated(BenchHost* host) {
+    setup_filters(host);
+    host->ports[PORT_WET_RATE] = 1;
+}
+
+static void setup_quarter(BenchHost* host) {
+    host->ports[PORT_HIGH_ON] = 1;
+    host->ports[PORT_HIGH_F] = 7500;
+    host->ports[PORT_WET_RATE] = 2;
+}
+
+static void setup_quarter_hi(BenchHost* host) {
+    setup_quarter(host);
+    host->ports[PORT_HIGH_F] = 22000;
+}
+
+static void setup_wow(BenchHost* host) {
+    host->ports[PORT_MOD_DEPTH] = 2;
+    host->ports[PORT_MOD_RATE] = 0.5;
+}
+
+static void setup_chorus(BenchHost* host) {
+    host->ports[PORT_MOD_DEPTH] = 3;
+    host->ports[PORT_MOD_RATE] = 0.8;
+    host->ports[PORT_MOD_SHAPE] = 1;
+}
+
+static void setup_tap(BenchHost* host) {
+    host->ports[PORT_TEMPO_MODE] = 2;
+    host->ports[PORT_DIV_R] = 2;
+}
+
+static void block_tap(BenchHost* host) {
+    // Four taps 0.4 s apart, the button is held for one block
+    const uint64_t step = (uint64_t)(0.4 * host->rate);
+    host->ports[PORT_TAP] = 
+        host->frame % step < host->block && host->frame < 4 * step;
+}
+
+static const BenchScenario scenarios[] = {
+    { "plain",      "default settings",             false, NULL, NULL },
+    { "filters",    "low and high cut on",          false,
+        setup_filters, NULL },
+    { "sweep",      "filter cut offs swept",        false,
+        setup_filters, block_sweep },
+    { "tempo",      "host tempo changes",           false,
+        setup_tempo, block_tempo },
+    { "feedback",   "full feedback, hermite",       false,
+        setup_feedback, NULL },
+    { "heads",      "three extra read heads",       false,
+        setup_heads, NULL },
+    { "tap",        "tempo from a tap sequence",    false,
+        setup_tap, block_tap },
+    { "silent",     "digital silence on the input", true, NULL, NULL },
+    { "decimated",  "low and high cut on, half rate", false,
+        setup_decimated, NULL },
+    { "quarter",    "high cut at default, quarter rate", false,
+        setup_quarter, NULL },
+    { "quarter-hi", "high cut at 22 kHz, quarter rate", false,
+        setup_quarter_hi, NULL },
+    { "wow",        "tape wow and flutter",         false,
+        setup_wow, NULL },
+    { "chorus",     "chorus, sides in quadrature",  false,
+        setup_chorus, NULL },
+};
+
+#define N_SCENARIOS (sizeof(scenarios) / sizeof(scenarios[0]))
+
+/**
+* Returns a monotonic time stamp in nanoseconds.
+*/
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+* Instantiates, sets up and activates the plugin for one scenario.
+* \return false if the plugin could not be instantiated
+*/
+static bool host_open(BenchHost* host, const BenchScenario* sc,
+    double rate, uint32_t block,
+    void (*input)(BenchHost* host, uint32_t n_samples)) {
+
+    int32_t max_block = block;
+    LV2_Options_Option options[] = {
+        { LV2_OPTIONS_INSTANCE, 0,
+            map_uri(NULL, LV2_BUF_SIZE__maxBlockLength),
+            sizeof(int32_t), map_uri(NULL, LV2_ATOM__Int), &max_block },
+        { LV2_OPTIONS_INSTANCE, 0, 0, 0, 0, NULL },
+    };
+    const LV2_Feature map_feature = { LV2_URID__map, &urid_map };
+    const LV2_Feature options_feature = { LV2_OPTIONS__options, options };
+    const LV2_Feature* features[] = { &map_feature, &options_feature, NULL };
+
+    host->rate = rate;
+    host->block = block;
+    host->frame = 0;
+    host->noise = 1;
+    host->input = input;
+    host->handle = host->desc->instantiate(host->desc, rate, "", features);
+    if (!host->handle)
+        return false;
+
+    host->in_l = calloc(block, sizeof(float));
+    host->in_r = calloc(block, sizeof(float));
+    host->out_l = calloc(block, sizeof(float));
+    host->out_r = calloc(block, sizeof(float));
+
+    memcpy(host->ports, port_defaults, sizeof(host->ports));
+    if (sc->setup)
+        sc->setup(host);
+    for (uint32_t p = 0 ; p < BENCH_PORTS ; ++p) {
+        if (p != PORT_LOAD_AVG && p != PORT_LOAD_PEAK)
+            host->desc->connect_port(host->handle, p, &host->ports[p]);
+    }
+    host->desc->connect_port(host->handle, PORT_INPUT_L, host->in_l);
+    host->desc->connect_port(host->handle, PORT_INPUT_R, host->in_r);
+    host->desc->connect_port(host->handle, PORT_OUTPUT_L, host->out_l);
+    host->desc->connect_port(host->handle, PORT_OUTPUT_R, host->out_r);
+    host->desc->connect_port(host->handle, PORT_CONTROL, host->seq);
+    seq_clear(host);
+
+    host->desc->activate(host->handle);
+    return true;
+}
+
+/**
+* Deactivates and frees the plugin instance.
+*/
+static void host_close(BenchHost* host) {
+    host->desc->deactivate(host->handle);
+    host->desc->cleanup(host->handle);
+    free(host->in_l);
+    free(host->in_r);
+    free(host->out_l);
+    free(host->out_r);
+}
+
+/**
+* Renders a number of blocks and returns the time spent in run().
+* \param host   host state
+* \param sc     scenario
+* \param n_blocks number of blocks to render
+* \param out    receives the interleaved output if not NULL
+*/
+static double host_run(BenchHost* host, const BenchScenario* sc,
+    uint64_t n_blocks, float* out) {
+
+    double spent = 0;
+    for (uint64_t b = 0 ; b < n_blocks ; ++b) {
+        if (!sc->silent)
+            host->input(host, host->block);
+        seq_clear(host);
+        if (sc->block)
+            sc->block(host);
+
+        const double start = now_ns();
+        host->desc->run(host->handle, host->block);
+        spent += now_ns() - start;
+        host->frame += host->block;
+
+        if (out) {
+            for (uint32_t i = 0 ; i < host->block ; ++i) {
+                *out++ = host->out_l[i];
+                *out++ = host->out_r[i];
+            }
+        }
+    }
+    return spent;
+}
+
+/**
+* Times one scenario at one rate and block size and prints the result.
+* \return false if the plugin could not be instantiated
+*/
+static bool bench(const BenchScenario* sc, double rate, uint32_t block,
+    double seconds) {
+
+    BenchHost host;
+    host.desc = lv2_descriptor(0);
+    if (!host_open(&host, sc, rate, block, input_noise))
+        return false;
+
+    host_run(&host, sc, (uint64_t)(BENCH_WARMUP * rate / block) + 1, NULL);
+    const uint64_t n_blocks = (uint64_t)(seconds * rate / block) + 1;
+    const double ns = host_run(&host, sc, n_blocks, NULL) 
+        / (n_blocks * block);
+    host_close(&host);
+
+    printf("%-10s %7.0f %5u %10.2f %12.0f\n", sc->name, rate, block, ns,
+        1e9 / (ns * rate));
+    fflush(stdout);
+    return true;
+}
+
+/**
+* Renders one scenario with one stimulus and either stores the output as
+* reference or compares it against the stored one.
+* \param dir    directory of the reference files
+* \param compare compare instead of storing
+* \param tolerance largest sample difference that passes
+* \return false if the render could not be stored or did not pass
+*/
+static bool render(const BenchScenario* sc, const BenchStimulus* st,
+    double rate, uint32_t block, double seconds, const char* dir,
+    bool compare, double tolerance) {
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s-%s.raw", dir, sc->name, st->name);
+
+    BenchHost host;
+    host.desc = lv2_descriptor(0);
+    if (!host_open(&host, sc, rate, block, st->input)) {
+        fprintf(stderr, "instantiation failed\n");
+        return false;
+    }
+    const uint64_t n_blocks = (uint64_t)(seconds * rate / block) + 1;
+    const size_t n = n_blocks * block * 2;
+    float* out = malloc(n * sizeof(float));
+    host_run(&host, sc, n_blocks, out);
+    host_close(&host);
+
+    bool ok = true;
+    if (!compare) {
+        FILE* f = fopen(path, "wb");
+        ok = f && fwrite(out, sizeof(float), n, f) == n;
+        if (f)
+            ok = !fclose(f) && ok;
+        printf("%-32s %s\n", path, ok ? "written" : "write failed");
+    }
+    else {
+        float* ref = malloc(n * sizeof(float));
+        FILE* f = fopen(path, "rb");
+        size_t n_ref = f ? fread(ref, sizeof(float), n, f) : 0;
+        if (f)
+            fclose(f);
+
+        double diff = 0;
+        for (size_t i = 0 ; i < n_ref ; ++i)
+            diff = fmax(diff, fabs((double)out[i] - ref[i]));
+        ok = n_ref == n && diff <= tolerance;
+        if (n_ref != n)
+            printf("%-32s missing or too short\n", path);
+        else
+            printf("%-32s max diff %9.3g  %s\n", path, diff, 
+                ok ? "ok" : "FAILED");
+        free(ref);
+    }
+    fflush(stdout);
+    free(out);
+    return ok;
+}
+
+static void usage(const char* name) {
+    fprintf(stderr,
+        "usage: %s [-t seconds] [-r rate] [-b block] [-w dir | -c dir]\n"
+        "       [-e tolerance] [scenario ...]\n\n"
+        "  -t   seconds timed or rendered per run\n"
+        "  -r   sample rate, all common rates by default\n"
+        "  -b   block size, 16 to 4096 by default\n"
+        "  -w   write reference renders into dir\n"
+        "  -c   compare renders against the references in dir\n"
+        "  -e   tolerance for -c, default %g\n\n"
+        "scenarios:\n", name, BENCH_TOLERANCE);
+    for (uint32_t i = 0 ; i < N_SCENARIOS ; ++i)
+        fprintf(stderr, "  %-10s %s\n", scenarios[i].name,
+            scenarios[i].info);
+}
+
+int main(int argc, char** argv) {
+    static const double default_rates[] = { 44100, 48000, 96000, 192000 };
+    static const uint32_t default_blocks[] = { 16, 64, 256, 1024, 4096 };
+    const double* rates = default_rates;
+    const uint32_t* blocks = default_blocks;
+    uint32_t n_rates = 4;
+    uint32_t n_blocks = 5;
+    double seconds = 0;
+    double rate = 48000;
+    uint32_t block = 128;
+    const char* dir = NULL;
+    bool compare = false;
+    double tolerance = BENCH_TOLERANCE;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:r:b:w:c:e:h")) != -1) {
+        switch (opt) {
+            case 't':
+                seconds = atof(optarg);
+                break;
+            case 'r':
+                rate = atof(optarg);
+                rates = &rate;
+                n_rates = 1;
+                break;
+            case 'b':
+                block = atoi(optarg);
+                blocks = &block;
+                n_blocks = 1;
+                break;
+            case 'w':
+            case 'c':
+                dir = optarg;
+                compare = opt == 'c';
+                break;
+            case 'e':
+                tolerance = atof(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (dir) {
+        // References are rendered at one rate and block size
+        rates = &rate;
+        blocks = &block;
+        n_rates = n_blocks = 1;
+    }
+    if (seconds == 0)
+        seconds = dir ? BENCH_RENDER_TIME : 5;
+    if (seconds <= 0 || rates[0] <= 0 || blocks[0] == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    for (int a = optind ; a < argc ; ++a) {
+        uint32_t s = 0;
+        while (s < N_SCENARIOS && strcmp(argv[a], scenarios[s].name))
+            ++s;
+        if (s == N_SCENARIOS) {
+            fprintf(stderr, "unknown scenario: %s\n", argv[a]);
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (!dir)
+        printf("%-10s %7s %5s %10s %12s\n", "scenario", "rate", "block",
+            "ns/sample", "inst/core");
+    bool ok = true;
+    for (uint32_t s = 0 ; s < N_SCENARIOS ; ++s) {
+        bool wanted = optind == argc;
+        for (int a = optind ; a < argc ; ++a)
+            if (!strcmp(argv[a], scenarios[s].name))
+                wanted = true;
+        if (!wanted)
+            continue;
+
+        if (dir) {
+            for (uint32_t t = 0 ; t < N_STIMULI ; ++t)
+                ok = render(&scenarios[s], &stimuli[t], rates[0], 
+                    blocks[0], seconds, dir, compare, tolerance) && ok;
+            continue;
+        }
+        for (uint32_t r = 0 ; r < n_rates ; ++r) {
+            for (uint32_t b = 0 ; b < n_blocks ; ++b) {
+                if (!bench(&scenarios[s], rates[r], blocks[b], seconds)) {
+                    fprintf(stderr, "instantiation failed\n");
+                    return 1;
+                }
+            }
+        }
+    }
+    return ok ? 0 : 1;
+}
@@ -24,23 +24,247 @@
 * \brief An LV2 tempo delay plugin with filters and tapping.
 */
 
+#include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
-#include <sys/time.h>
+#include <time.h>
 #include "bolliefilter.h"
+#include "bollieresample.h"
+#include "bollietape.h"
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
 
 #include "lv2/lv2plug.in/ns/lv2core/lv2.h"
+#include "lv2/lv2plug.in/ns/ext/atom/atom.h"
+#include "lv2/lv2plug.in/ns/ext/atom/util.h"
+#include "lv2/lv2plug.in/ns/ext/buf-size/buf-size.h"
+#include "lv2/lv2plug.in/ns/ext/options/options.h"
+#include "lv2/lv2plug.in/ns/ext/state/state.h"
+#include "lv2/lv2plug.in/ns/ext/time/time.h"
+#include "lv2/lv2plug.in/ns/ext/urid/urid.h"
+#include "lv2/lv2plug.in/ns/ext/worker/worker.h"
+
+#define BDL_URI "https://ca9.eu/lv2/bolliedelay"
+
+/**
+* State properties
+*/
+#define BDL__tempoTap   BDL_URI "#tempoTap"
+#define BDL__delayL     BDL_URI "#delayL"
+#define BDL__delayR     BDL_URI "#delayR"
+#define BDL__feedback   BDL_URI "#feedback"
+#define BDL__crossfeed  BDL_URI "#crossfeed"
+#define BDL__wetGain    BDL_URI "#wetGain"
+#define BDL__dryGain    BDL_URI "#dryGain"
+#define BDL__tape       BDL_URI "#tape"
+#define BDL__decimation BDL_URI "#decimation"
+
+/**
+* Longest delay time the tape has to hold in seconds. This is a quarter note
+* at the lowest tempo (6 BPM) the ports allow.
+*/
+#define MAX_DELAY_TIME 10
+
+/**
+* Delay time the tape holds initially in seconds, if the host has a worker
+* to get a longer tape from when it is needed.
+*/
+#define TAPE_DEFAULT_TIME 2
+
+/**
+* Replaced tapes waiting for the worker to release them. A resize is only
+* requested once all of them are gone. While it runs, only the tape it
+* copies from is kept here by a restore, and its response adds one, so
+* there are never more than two. Tapes save() is reading wait here too.
+*/
+#define STALE_TAPES 2
+
+/**
+* Maximum number of samples processed by the tape kernel in one go.
+*/
+#define KERNEL_LEN 64
+
+/**
+* Length of the scratch buffers, if the host doesn't tell the block length.
+* Longer blocks are processed in parts of this length, so it is also the
+* upper bound for the block length told by the host.
+*/
+#define SCRATCH_LEN 4096
+
+/**
+* Alignment of the scratch buffers in bytes, a cache line.
+*/
+#define SCRATCH_ALIGN 64
+
+/**
+* Number of tap intervals averaged for the tapped tempo.
+*/
+#define TAP_HISTORY 4
+
+/**
+* Relative deviation from the median at which a tap interval counts as
+* outlier.
+*/
+#define TAP_TOLERANCE 0.25
+
+/**
+* Level below which input and tape count as silent, -120 dB.
+*/
+#define SILENCE_LEVEL 1e-6f
 
-#define URI "https://ca9.eu/lv2/bolliedelay"
+/**
+* Number of additional read heads for multi-tap patterns.
+*/
+#define TAP_HEADS 3
+
+/**
+* Time in seconds over which the DSP load ports are averaged.
+*/
+#define LOAD_WINDOW 0.5
+
+/**
+* One cycle of an LFO shape has 2^MOD_TABLE_BITS samples.
+*/
+#define MOD_TABLE_BITS 10
+#define MOD_TABLE_LEN (1 << MOD_TABLE_BITS)
+
+
+
+
+/**
+* Sample format of the tape, selected at compile time with TAPE_INT16 or
+* TAPE_HALF. Both compact formats halve the memory and cache traffic of the
+* tape. 16 bit fixed point keeps 12 dB of headroom for feedback peaks and
+* rounds to nearest. tape_feed() stores the recirculating samples: once the
+* input has gone silent it truncates towards zero instead, so a bare tail
+* loses at least one step per pass and decays to silence rather than
+* sticking in a limit cycle. It isn't dithered, as that would keep the tape
+* from ever going silent.
+*/
+#if defined(TAPE_INT16)
+typedef int16_t tape_t;
+#define TAPE_SCALE 8192.f    // exact conversions, 12 dB headroom
+static inline float tape_load(tape_t s) { return s * (1.f / TAPE_SCALE); }
+static inline float tape_clip(float x) {
+    x *= TAPE_SCALE;
+    x = x > 32767.f ? 32767.f : x;
+    return x < -32767.f ? -32767.f : x;
+}
+static inline tape_t tape_store(float x) {
+    return (tape_t)lrintf(tape_clip(x));
+}
+static inline tape_t tape_feed(float x, float in) {
+    return fabsf(in) < SILENCE_LEVEL
+        ? (tape_t)tape_clip(x) : (tape_t)lrintf(tape_clip(x));
+}
+#elif defined(TAPE_HALF)
+typedef _Float16 tape_t;
+static inline float tape_load(tape_t s) { return (float)s; }
+static inline tape_t tape_store(float x) { return (tape_t)x; }
+static inline tape_t tape_feed(float x, float in) { return (tape_t)x; }
+#else
+typedef float tape_t;
+static inline float tape_load(tape_t s) { return s; }
+static inline tape_t tape_store(float x) { return x; }
+static inline tape_t tape_feed(float x, float in) { return x; }
+#endif
+
+/**
+* Layout of the tape, selected at compile time with TAPE_INTERLEAVED. By
+* default each channel has its own half of the allocation. Interleaved, the
+* samples of both channels alternate, so reading or writing both channels
+* at one position touches a single cache line and page. TAPE_STRIDE is the
+* distance between two samples of the same channel.
+*/
+#if defined(TAPE_INTERLEAVED)
+#define TAPE_STRIDE 2
+#else
+#define TAPE_STRIDE 1
+#endif
+
+/**
+* Returns the right channel of a tape allocated for both channels.
+* \param tape the tape, starting with the left channel
+* \param len length of each channel in samples
+*/
+static inline tape_t* tape_right(tape_t* tape, uint32_t len) {
+#if defined(TAPE_INTERLEAVED)
+    return tape + 1;
+#else
+    return tape + len;
+#endif
+}
 
-#define MAX_TAPE_LEN 1920001
+/**
+* Allocation size for a tape of at least len samples per channel. Channels
+* are rounded up to a power of two, so positions wrap with a mask.
+* \param len wanted length of each channel in samples
+* \return size for both channels in bytes
+*/
+static inline size_t tape_size(uint32_t len) {
+    size_t n = 1;
+    while (n < len)
+        n <<= 1;
+    return 2 * n * sizeof(tape_t);
+}
 
+/**
+* Channel length of a tape allocation, the biggest power of two that fits.
+* \param size size of the allocation for both channels in bytes
+* \return length of each channel in samples
+*/
+static inline uint32_t tape_fit(size_t size) {
+    const size_t n = size / (2 * sizeof(tape_t));
+    uint32_t len = 1;
+    while ((size_t)len * 2 <= n)
+        len <<= 1;
+    return len;
+}
 
 /**
-* Make a bool type available. ;)
+* Switches the FPU to flush denormals to zero, so decaying feedback and
+* filter states don't fall onto the slow path.
+* \return previous FPU state for denormals_restore()
 */
-typedef enum { false, true } bool;
+static inline unsigned long denormals_disable(void) {
+#if defined(__SSE__)
+    unsigned long csr = _mm_getcsr();
+    _mm_setcsr(csr | 0x8040);   // FTZ and DAZ
+    return csr;
+#elif defined(__aarch64__)
+    unsigned long fpcr;
+    __asm__ __volatile__("mrs %0, fpcr" : "=r"(fpcr));
+    __asm__ __volatile__("msr fpcr, %0" : : "r"(fpcr | (1UL << 24)));
+    return fpcr;
+#elif defined(__arm__) && defined(__ARM_FP)
+    unsigned long fpscr;
+    __asm__ __volatile__("vmrs %0, fpscr" : "=r"(fpscr));
+    __asm__ __volatile__("vmsr fpscr, %0" : : "r"(fpscr | (1UL << 24)));
+    return fpscr;
+#else
+    return 0;
+#endif
+}
 
+/**
+* Restores the FPU state the host had set.
+* \param state value returned by denormals_disable()
+*/
+static inline void denormals_restore(unsigned long state) {
+#if defined(__SSE__)
+    _mm_setcsr(state);
+#elif defined(__aarch64__)
+    __asm__ __volatile__("msr fpcr, %0" : : "r"(state));
+#elif defined(__arm__) && defined(__ARM_FP)
+    __asm__ __volatile__("vmsr fpscr, %0" : : "r"(state));
+#else
+    (void)state;
+#endif
+}
 
 /**
 * Enumeration of LV2 ports
@@ -66,8 +290,92 @@ typedef enum {
     BDL_OUTPUT_L    = 17,
     BDL_OUTPUT_R    = 18,
     BDL_TEMPO_OUT   = 19,
+    BDL_CONTROL     = 20,
+    BDL_TRAILS      = 21,
+    BDL_INTERP      = 22,
+    BDL_HEAD_DIV    = 23,   ///< divider of the first head, then every 3rd
+    BDL_HEAD_GAIN   = 24,   ///< gain of the first head, then every 3rd
+    BDL_HEAD_PAN    = 25,   ///< pan of the first head, then every 3rd
+    BDL_LOAD_AVG    = 32,
+    BDL_LOAD_PEAK   = 33,
+    BDL_WET_RATE    = 34,
+    BDL_MOD_DEPTH   = 35,
+    BDL_MOD_RATE    = 36,
+    BDL_MOD_SHAPE   = 37,
 } PortIdx;
 
+/**
+* LFO shapes of the modulation
+*/
+typedef enum {
+    MOD_TAPE    = 0,    ///< wow with some flutter on top, both sides alike
+    MOD_CHORUS  = 1,    ///< sine, the right side a quarter cycle ahead
+} ModShape;
+
+#define MOD_SHAPES 2
+
+/**
+* An additional read head. It reads both channels of the tape and adds to
+* the wet signal only, the feedback stays with the main heads.
+*/
+typedef struct {
+    const float* div;   ///< Divider enum (same as div_l/div_r)
+    const float* gain;  ///< gain in percentage, 0 switches the head off
+    const float* pan;   ///< pan in percentage, -100 (left) to 100 (right)
+    float cur_div;      ///< divider the delay time is set up for
+    double d;           ///< current delay time
+    double tgt_d;       ///< target delay time
+    float gain_l;       ///< current gain, left side
+    float gain_r;       ///< current gain, right side
+    float tgt_gain_l;   ///< target gain, left side
+    float tgt_gain_r;   ///< target gain, right side
+    float ap_l;         ///< allpass interpolator state, left side
+    float ap_r;         ///< allpass interpolator state, right side
+} BollieHead;
+
+/**
+* URIDs used by the plugin
+*/
+typedef struct {
+    LV2_URID atom_Blank;
+    LV2_URID atom_Double;
+    LV2_URID atom_Float;
+    LV2_URID atom_Int;
+    LV2_URID atom_Long;
+    LV2_URID atom_Object;
+    LV2_URID atom_Path;
+    LV2_URID bufsz_maxBlockLength;
+    LV2_URID bufsz_nominalBlockLength;
+    LV2_URID time_Position;
+    LV2_URID time_beatsPerMinute;
+    LV2_URID bdl_tempoTap;
+    LV2_URID bdl_delayL;
+    LV2_URID bdl_delayR;
+    LV2_URID bdl_feedback;
+    LV2_URID bdl_crossfeed;
+    LV2_URID bdl_wetGain;
+    LV2_URID bdl_dryGain;
+    LV2_URID bdl_tape;
+    LV2_URID bdl_decimation;
+} BollieURIs;
+
+/**
+* What save() stores besides the tape. run() publishes it at the end of
+* each block between tape_change_begin() and tape_change_end(), save()
+* copies it together with the tape position, so no value can tear.
+*/
+typedef struct {
+    double delay_l;     ///< current delay time, left side
+    double delay_r;     ///< current delay time, right side
+    double longest;     ///< longest_delay(), the region of the tape to save
+    float tempo_tap;    ///< tapped tempo
+    float feedback;     ///< current feedback gain
+    float crossf;       ///< current crossfeed gain
+    float wet_gain;     ///< current wet gain
+    float dry_gain;     ///< current dry gain
+    unsigned int decim; ///< the wet path runs at rate / decim
+} SavedState;
+
 /**
 * Struct for THE BollieDelay instance, the host is going to use.
 */
@@ -92,34 +400,155 @@ typedef struct {
     const float* input_r;       ///< input1, right side
     float* output_l;            ///< output1, left side
     float* output_r;            ///< output2, right side
+    const LV2_Atom_Sequence* control; ///< events like time:Position from host
+    const float* trails_port;   ///< Trails: 0=off, 1=keep tails on activate
+    const float* interp;        ///< Interpolation enum, see Interp
+    float* load_avg;            ///< average DSP load in % of real time
+    float* load_peak;           ///< worst DSP load of a run() in % of real time
+    const float* wet_rate;      ///< Wet rate enum, 0=full, 1=half, 2=quarter
+    const float* mod_depth;     ///< modulation depth in ms, 0 switches it off
+    const float* mod_rate;      ///< modulation rate in Hz
+    const float* mod_shape;     ///< LFO shape enum, see ModShape
+
+    LV2_URID_Map* map;          ///< URID mapping, NULL if the host has none
+    BollieURIs uris;            ///< mapped URIDs
 
     double rate;                ///< Current sample rate
-
-    float buffer_l[MAX_TAPE_LEN];   ///< delay buffer left
-    float buffer_r[MAX_TAPE_LEN];   ///< delay buffer right
-
-    BollieFilter filter_low_l;      ///< LCF left
-    BollieFilter filter_low_r;      ///< LCF right
-    BollieFilter filter_high_l;     ///< HCF left
-    BollieFilter filter_high_r;     ///< HCF right
+    double tape_rate;           ///< sample rate of the wet path and the tape
+    unsigned int decim;         ///< the wet path runs at rate / decim
+    BollieResampler resampler;  ///< half-band stages around the wet path
+
+    tape_t* buffer_l;           ///< delay buffer left
+    tape_t* buffer_r;           ///< delay buffer right
+    uint32_t tape_len;          ///< length of each delay buffer, power of two
+    bool tape_full;             ///< the write position wrapped since activate
+    bool restored;              ///< state was restored, keep it on activate
+    bool trails;                ///< trails port at the last run
+    uint32_t max_len;           ///< tape length for MAX_DELAY_TIME
+    LV2_Worker_Schedule* schedule; ///< worker, NULL if the host has none
+    bool resize_pending;        ///< a longer tape has been requested
+    const tape_t* resize_from;  ///< tape the pending resize copies from
+    tape_t* stale[STALE_TAPES]; ///< replaced tapes the worker couldn't take
+    uint32_t n_stale;           ///< number of tapes in stale
+    uint32_t tape_epoch;        ///< changes whenever recording starts over
+    uint64_t tape_written;      ///< samples recorded since instantiate
+    uint32_t tape_seq;          ///< odd while run() changes the tape position
+    uint32_t tape_readers;      ///< save() calls reading the tape
+    SavedState saved;           ///< published for save() by run()
+    bool silent;                ///< input and tape are silent, bypassing
+    uint64_t quiet_frames;      ///< frames since input or tape was audible
+
+    float* scratch_l;           ///< filtered input, left side
+    float* scratch_r;           ///< filtered input, right side
+    uint32_t scratch_len;       ///< length of each scratch buffer in samples
+
+    BollieStereoFilter filter_low;  ///< LCF for both channels
+    BollieStereoFilter filter_high; ///< HCF for both channels
 
     float tempo_tap;    ///< storing tapped tempo
-    float cur_tempo;    ///< state variable for current tempo set by tempo (above)
+    float host_bpm;     ///< tempo from time:Position events, 0 if none
+    float host_port;    ///< tempo_host port value when host_bpm arrived
+    float cur_tempo;    ///< state var for current tempo set by tempo (above)
     float cur_div_l;    ///< state var for current division, left side
     float cur_div_r;    ///< state var for current division, right side
+    int cur_interp;     ///< interpolation mode the delay times are set up for
     double cur_d_t_ch1; ///< current delay time
     double cur_d_t_ch2; ///< current delay time
     int pos_w;          ///< current write position, left side
-    int start_tap;      ///< when did the last tap happen (ms since epoch)
+    uint64_t frames;    ///< number of frames processed since instantiation
+    uint64_t start_tap; ///< when did the last tap happen (frame)
+    bool tap_armed;     ///< start_tap holds a tap to measure from
+    float last_tap;     ///< tap port value of the previous block
+    double tap_intervals[TAP_HISTORY]; ///< recent tap intervals in frames
+    uint32_t tap_count; ///< number of valid entries in tap_intervals
+    uint32_t tap_next;  ///< ring position for the next tap interval
+    double tap_outlier; ///< rejected interval, zero if there is none
     float dry_gain;     ///< current state leading towards target dry gain
     float wet_gain;     ///< current state leading towards target wet gain
     float cur_feedback; ///< current state leading towards target feedback gain
     float cur_crossf;   ///< current state leading towards target crossfeed gain
     double tgt_d_t_ch1; ///< target delay time
     double tgt_d_t_ch2; ///< target delay time
+    float ap_l;         ///< allpass interpolator state, left side
+    float ap_r;         ///< allpass interpolator state, right side
+    double cur_mod_depth; ///< current modulation depth in samples
+    uint32_t mod_phase; ///< LFO phase, a cycle spans the whole range
+    float mod_wave[MOD_SHAPES][MOD_TABLE_LEN + 1]; ///< one cycle per shape
+    BollieHead heads[TAP_HEADS]; ///< additional read heads
+    bool heads_active;  ///< any of the heads is audible in this block
+    double load_time;   ///< ns spent in run() during the load window
+    uint64_t load_frames; ///< frames processed during the load window
+    float load_max;     ///< worst load of a run() during the load window
 } BollieDelay;
 
 
+/**
+* Looks up a feature passed by the host.
+* \param features NULL terminated list of features
+* \param uri URI of the feature
+* \return feature data or NULL if the host didn't pass it
+*/
+static void* find_feature(const LV2_Feature* const* features, const char* uri) {
+    for (int i = 0 ; features && features[i] ; ++i) {
+        if (!strcmp(features[i]->URI, uri))
+            return features[i]->data;
+    }
+    return NULL;
+}
+
+
+/**
+* Finds the length the scratch buffers should have from the host's options.
+* The maximum block length is preferred, the nominal block length is the
+* next best guess. Blocks exceeding it are still fine, just split.
+* \param self pointer to current plugin instance
+* \param options options passed by the host or NULL
+* \return length of the scratch buffers in samples
+*/
+static uint32_t block_length(BollieDelay* self, 
+    const LV2_Options_Option* options) {
+
+    if (!self->map || !options)
+        return SCRATCH_LEN;
+
+    int64_t max_len = 0;
+    int64_t nominal_len = 0;
+    for (; options->key ; ++options) {
+        int64_t v = 0;
+        if (options->type == self->uris.atom_Int)
+            v = *(const int32_t*)options->value;
+        else if (options->type == self->uris.atom_Long)
+            v = *(const int64_t*)options->value;
+
+        if (options->key == self->uris.bufsz_maxBlockLength)
+            max_len = v;
+        else if (options->key == self->uris.bufsz_nominalBlockLength)
+            nominal_len = v;
+    }
+
+    int64_t len = max_len > 0 ? max_len : nominal_len;
+    if (len <= 0 || len > SCRATCH_LEN)
+        return SCRATCH_LEN;
+    return (uint32_t)len;
+}
+
+/**
+* Fills one cycle of every LFO shape, with the first sample repeated at the
+* end for the interpolation. The shapes stay within -1 and 1.
+* \param self pointer to current plugin instance
+*/
+static void mod_tables(BollieDelay* self) {
+    for (uint32_t i = 0 ; i <= MOD_TABLE_LEN ; ++i) {
+        const double t = 2 * M_PI * i / MOD_TABLE_LEN;
+        self->mod_wave[MOD_CHORUS][i] = (float)sin(t);
+
+        // Flutter five times as fast as the wow, a tenth as deep
+        self->mod_wave[MOD_TAPE][i] = 
+            (float)((sin(t) + 0.1 * sin(5 * t + 1)) / 1.1);
+    }
+}
+
+
 /**
 * Instantiates the plugin
 * Allocates memory for the BollieDelay object and returns a pointer as
@@ -129,9 +558,79 @@ static LV2_Handle instantiate(const LV2_Descriptor * descriptor, double rate,
     const char* bundle_path, const LV2_Feature* const* features) {
     
     BollieDelay *self = (BollieDelay*)calloc(1, sizeof(BollieDelay));
+    if (!self)
+        return NULL;
 
     // Memorize sample rate for calculation
     self->rate = rate;
+    self->tape_rate = rate;
+    self->decim = 1;
+    self->saved.decim = 1;
+    br_init(&self->resampler, 1);
+    mod_tables(self);
+
+    // Host tempo events and state can only be handled with URID mapping
+    self->map = (LV2_URID_Map*)find_feature(features, LV2_URID__map);
+    if (self->map) {
+        LV2_URID_Map* map = self->map;
+        self->uris.atom_Blank = map->map(map->handle, LV2_ATOM__Blank);
+        self->uris.atom_Double = map->map(map->handle, LV2_ATOM__Double);
+        self->uris.atom_Float = map->map(map->handle, LV2_ATOM__Float);
+        self->uris.atom_Int = map->map(map->handle, LV2_ATOM__Int);
+        self->uris.atom_Long = map->map(map->handle, LV2_ATOM__Long);
+        self->uris.atom_Object = map->map(map->handle, LV2_ATOM__Object);
+        self->uris.atom_Path = map->map(map->handle, LV2_ATOM__Path);
+        self->uris.bufsz_maxBlockLength = 
+            map->map(map->handle, LV2_BUF_SIZE__maxBlockLength);
+        self->uris.bufsz_nominalBlockLength = 
+            map->map(map->handle, LV2_BUF_SIZE__nominalBlockLength);
+        self->uris.time_Position = map->map(map->handle, LV2_TIME__Position);
+        self->uris.time_beatsPerMinute = 
+            map->map(map->handle, LV2_TIME__beatsPerMinute);
+        self->uris.bdl_tempoTap = map->map(map->handle, BDL__tempoTap);
+        self->uris.bdl_delayL = map->map(map->handle, BDL__delayL);
+        self->uris.bdl_delayR = map->map(map->handle, BDL__delayR);
+        self->uris.bdl_feedback = map->map(map->handle, BDL__feedback);
+        self->uris.bdl_crossfeed = map->map(map->handle, BDL__crossfeed);
+        self->uris.bdl_wetGain = map->map(map->handle, BDL__wetGain);
+        self->uris.bdl_dryGain = map->map(map->handle, BDL__dryGain);
+        self->uris.bdl_tape = map->map(map->handle, BDL__tape);
+        self->uris.bdl_decimation = map->map(map->handle, BDL__decimation);
+    }
+
+    /* The tape is sized for the longest delay at this sample rate, or for
+    a shorter default if the worker can bring a longer tape later. It is at
+    least one sample bigger than the delay time and both channels share
+    one allocation, each channel a power of two long. The pool may hand out
+    more than requested, a bigger power of two is used. The tape isn't
+    cleared, only recorded samples are ever read. */
+    self->schedule = 
+        (LV2_Worker_Schedule*)find_feature(features, LV2_WORKER__schedule);
+    self->max_len = (uint32_t)ceil(MAX_DELAY_TIME * rate) + 1;
+    size_t size = self->schedule ? (size_t)ceil(TAPE_DEFAULT_TIME * rate) + 1
+        : self->max_len;
+    size = tape_size((uint32_t)size);
+    self->buffer_l = (tape_t*)bt_alloc(size, &size);
+    if (!self->buffer_l) {
+        free(self);
+        return NULL;
+    }
+    self->tape_len = tape_fit(size);
+    self->buffer_r = tape_right(self->buffer_l, self->tape_len);
+
+    /* The input is filtered block-wise into the scratch buffers. They are
+    sized for the block length the host announced, if any. */
+    self->scratch_len = block_length(self, (const LV2_Options_Option*)
+        find_feature(features, LV2_OPTIONS__options));
+    void* scratch = NULL;
+    if (posix_memalign(&scratch, SCRATCH_ALIGN, 
+        2 * (size_t)self->scratch_len * sizeof(float))) {
+        bt_free(self->buffer_l);
+        free(self);
+        return NULL;
+    }
+    self->scratch_l = (float*)scratch;
+    self->scratch_r = self->scratch_l + self->scratch_len;
 
     return (LV2_Handle)self;
 }
@@ -207,6 +706,50 @@ static void connect_port(LV2_Handle instance, uint32_t port, void *data) {
         case BDL_TEMPO_OUT:
             self->tempo_out = data;
             break;
+        case BDL_CONTROL:
+            self->control = data;
+            break;
+        case BDL_TRAILS:
+            self->trails_port = data;
+            break;
+        case BDL_INTERP:
+            self->interp = data;
+            break;
+        case BDL_LOAD_AVG:
+            self->load_avg = data;
+            break;
+        case BDL_LOAD_PEAK:
+            self->load_peak = data;
+            break;
+        case BDL_WET_RATE:
+            self->wet_rate = data;
+            break;
+        case BDL_MOD_DEPTH:
+            self->mod_depth = data;
+            break;
+        case BDL_MOD_RATE:
+            self->mod_rate = data;
+            break;
+        case BDL_MOD_SHAPE:
+            self->mod_shape = data;
+            break;
+        default:
+            // The ports of the heads follow each other
+            if (port >= BDL_HEAD_DIV && port < BDL_HEAD_DIV + 3 * TAP_HEADS) {
+                BollieHead* hd = &self->heads[(port - BDL_HEAD_DIV) / 3];
+                switch ((port - BDL_HEAD_DIV) % 3) {
+                    case 0:
+                        hd->div = data;
+                        break;
+                    case 1:
+                        hd->gain = data;
+                        break;
+                    case 2:
+                        hd->pan = data;
+                        break;
+                }
+            }
+            break;
     }
 }
     
@@ -217,64 +760,155 @@ static void connect_port(LV2_Handle instance, uint32_t port, void *data) {
 */
 static void activate(LV2_Handle instance) {
     BollieDelay* self = (BollieDelay*)instance;
-    // Let's remove all that noise
-    for (int i = 0 ; i < MAX_TAPE_LEN ; ++i) {
-        self->buffer_l[i] = 0;
-        self->buffer_r[i] = 0;
-    }
-
-    // Initialize number of samples needed
-    self->cur_d_t_ch1 = 0;
-    self->cur_d_t_ch2 = 0;
-    self->tgt_d_t_ch1 = 0;
-    self->tgt_d_t_ch2 = 0;
 
-    // Clear the filters
-    bf_reset(&self->filter_low_l);
-    bf_reset(&self->filter_low_r);
-    bf_reset(&self->filter_high_l);
-    bf_reset(&self->filter_high_r);
+    self->silent = false;
+    self->quiet_frames = 0;
+    self->load_time = 0;
+    self->load_frames = 0;
+    self->load_max = 0;
 
-    // Reset the positions & state variables
-    self->pos_w = 0;
+    // Let the next run calculate the delay times again
     self->cur_tempo = 0;
     self->cur_div_l = 0;
     self->cur_div_r = 0;
-    self->dry_gain = 0;
-    self->wet_gain = 0;
+    for (int h = 0 ; h < TAP_HEADS ; ++h)
+        self->heads[h].cur_div = 0;
+
+    /* With trails the echoes of the last run keep ringing. Tape, filters
+    and smoothers stay as they are, new port values (e.g. from a preset)
+    are reached through the usual smoothing. */
+    if (self->trails)
+        return;
+
+    // Clear the filters
+    bf_stereo_reset(&self->filter_low);
+    bf_stereo_reset(&self->filter_high);
+    br_reset(&self->resampler);
+    self->tgt_d_t_ch1 = 0;
+    self->tgt_d_t_ch2 = 0;
+    self->ap_l = 0;
+    self->ap_r = 0;
+    for (int h = 0 ; h < TAP_HEADS ; ++h) {
+        BollieHead* hd = &self->heads[h];
+        hd->d = 0;
+        hd->tgt_d = 0;
+        hd->gain_l = 0;
+        hd->gain_r = 0;
+        hd->ap_l = 0;
+        hd->ap_r = 0;
+    }
+    self->cur_mod_depth = 0;
+    self->mod_phase = 0;
 
     // Reset tapping
     self->start_tap = 0;
+    self->tap_armed = false;
+    self->last_tap = 0;
+    self->tap_count = 0;
+    self->tap_next = 0;
+    self->tap_outlier = 0;
+
+    // Until the host sends its position again, the port sets the tempo
+    self->host_bpm = 0;
+
+    // A freshly restored state is where playback continues
+    if (self->restored)
+        return;
+
+    /* Let's remove all that noise. Instead of clearing the whole tape,
+    it is marked empty: recording restarts at 0 and everything at or
+    behind the write position reads as silence until it wraps. */
+    self->tape_full = false;
+    self->pos_w = 0;
+    ++self->tape_epoch;
+
+    // Initialize number of samples needed
+    self->cur_d_t_ch1 = 0;
+    self->cur_d_t_ch2 = 0;
+
+    // Reset the state variables
+    self->dry_gain = 0;
+    self->wet_gain = 0;
     self->tempo_tap = 120;
 }
 
 
 /**
-* Handles a tap on the tap button and calculates time differences
+* Calculates the median of the memorized tap intervals.
 * \param self pointer to current plugin instance
-* \return Beats per minute or zero if it didn't work
+* \return median interval in frames
 */
-static float handle_tap(BollieDelay* self) {
-
-    float d = 0;
+static double tap_median(BollieDelay* self) {
+    double v[TAP_HISTORY];
+    uint32_t n = self->tap_count;
+
+    // Insertion sort, there are only a handful of values
+    for (uint32_t i = 0 ; i < n ; ++i) {
+        double x = self->tap_intervals[i];
+        uint32_t j = i;
+        for (; j > 0 && v[j-1] > x ; --j)
+            v[j] = v[j-1];
+        v[j] = x;
+    }
+    return n % 2 ? v[n/2] : (v[n/2-1] + v[n/2]) / 2;
+}
 
-    struct timeval t_cur;
-    gettimeofday(&t_cur, 0);
+/**
+* Memorizes a tap interval in the ring of recent intervals.
+* \param self pointer to current plugin instance
+* \param d interval in frames
+*/
+static void tap_push(BollieDelay* self, double d) {
+    self->tap_intervals[self->tap_next] = d;
+    self->tap_next = (self->tap_next + 1) % TAP_HISTORY;
+    if (self->tap_count < TAP_HISTORY)
+        self->tap_count++;
+}
 
-    // convert it to milliseconds
-    long int t_cur_ms = floor(t_cur.tv_sec * 1000 + t_cur.tv_usec / 1000);
+/**
+* Handles a tap on the tap button and calculates time differences.
+* Time is measured in processed frames, so tapping doesn't depend on the
+* system clock and works the same in offline renders. The tempo is averaged
+* over the last TAP_HISTORY intervals. An interval too far off their median
+* is ignored, unless the next one confirms it as a new tempo.
+* \param self pointer to current plugin instance
+* \param frame frame the tap happened at, counted since instantiation
+* \return Beats per minute or zero if it didn't work
+*/
+static float handle_tap(BollieDelay* self, uint64_t frame) {
 
     // If start tap is memorized, do some calculations
-    if (self->start_tap) {
-        d = t_cur_ms - self->start_tap;
+    double d = 0;
+    if (self->tap_armed)
+        d = (double)(frame - self->start_tap);
+    self->start_tap = frame;
+    self->tap_armed = true;
+
+    // Start over if we exceed the maximum delay time
+    if (d <= 0.05 * self->rate || d > MAX_DELAY_TIME * self->rate) {
+        self->tap_count = 0;
+        self->tap_outlier = 0;
+        return 0;
+    }
 
-        // Reset if we exceed the maximum delay time
-        if (d <= 50 || d > 10000 ) {
-            d = 0;
+    const double median = self->tap_count > 0 ? tap_median(self) : 0;
+    if (self->tap_count > 0 && fabs(d - median) > TAP_TOLERANCE * median) {
+        // Two outliers in a row agreeing with each other are a new tempo
+        double o = self->tap_outlier;
+        if (o == 0 || fabs(d - o) > TAP_TOLERANCE * o) {
+            self->tap_outlier = d;
+            return 0;
         }
+        self->tap_count = 0;
+        tap_push(self, o);
     }
-    self->start_tap = t_cur_ms;
-    return (d > 0 ? 60000 / d : 0);   // convert to bpm
+    self->tap_outlier = 0;
+    tap_push(self, d);
+
+    double sum = 0;
+    for (uint32_t i = 0 ; i < self->tap_count ; ++i)
+        sum += self->tap_intervals[i];
+    return 60 * self->rate * self->tap_count / sum;   // convert to bpm
 }
 
 
@@ -288,7 +922,7 @@ static float handle_tap(BollieDelay* self) {
 */
 static double calc_delay_samples(BollieDelay* self, float tempo, int div) {
     // Calculate the samples needed 
-    double d = 60 / tempo * self->rate;
+    double d = 60 / tempo * self->tape_rate;
     switch(div) {
         case 1:
         d = d * 2/3;
@@ -310,220 +944,1974 @@ static double calc_delay_samples(BollieDelay* self, float tempo, int div) {
 }
 
 /**
-* linear sample interpolation from buffer
+* Interpolation modes for reading the tape
+*/
+typedef enum {
+    INTERP_LINEAR   = 0,    ///< linear, cheap but dulls the repeats
+    INTERP_HERMITE  = 1,    ///< 4-point, 3rd-order Hermite
+    INTERP_ALLPASS  = 2,    ///< 1st-order allpass, flat magnitude response
+} Interp;
+
+/**
+* Reads one sample from the tape.
 * \param buf pointer to the buffer
-* \param x sample coordinate. Can be also negative.
-* \return interpolated sample
+* \param len length of the buffer, a power of two
+* \param valid number of recorded samples from the start of the buffer,
+*   everything behind reads as silence
+* \param x position, wrapped to the buffer
+* \return sample
 */
-static float interpolate(float *buf, double x) {
-    if (x < 0) x += MAX_TAPE_LEN;
-    if (x >= MAX_TAPE_LEN) x -= MAX_TAPE_LEN;
-    int32_t x0 = (int32_t)x;
-    float frac = x - (double)x0;
-    int32_t x1 = x0+1;
-    return buf[x0]  + frac * (buf[x1 >= MAX_TAPE_LEN ? 0 : x1] - buf[x0]);
+static inline float tape_at(const tape_t* buf, uint32_t len, uint32_t valid,
+    uint32_t x) {
+    x &= len - 1;
+    return x < valid ? tape_load(buf[TAPE_STRIDE * x]) : 0;
 }
 
 /**
-* Main process function of the plugin.
-* \param instance  handle of the current plugin
-* \param n_samples number of samples in this current input block.
+* 4-point, 3rd-order Hermite interpolation between x0 and x1.
+* \param xm1 sample before x0
+* \param x0 sample at the position
+* \param x1 sample after x0
+* \param x2 sample after x1
+* \param t fraction between x0 and x1
+* \return interpolated sample
 */
-static void run(LV2_Handle instance, uint32_t n_samples) {
-    BollieDelay* self = (BollieDelay*)instance;
+static inline float hermite(float xm1, float x0, float x1, float x2, float t) {
+    const float c1 = 0.5f * (x1 - xm1);
+    const float c2 = xm1 - 2.5f * x0 + 2.f * x1 - 0.5f * x2;
+    const float c3 = 0.5f * (x2 - xm1) + 1.5f * (x0 - x1);
+    return ((c3 * t + c2) * t + c1) * t + x0;
+}
 
-    // First some TAP handling
-    if (*(self->tap) > 0) {
-        float d = handle_tap(self);
-        if (d > 0) 
-            self->tempo_tap = (float)d;
-    }
+/**
+* Allpass interpolation. The fractional part of the delay is kept within
+* [0.5, 1.5) behind the newer sample, so the pole never gets close to the
+* unit circle.
+* \param s0 older sample
+* \param s1 newer sample
+* \param eta delay behind s1 in samples
+* \param y previous output, receives the new one
+* \return interpolated sample
+*/
+static inline float allpass(float s0, float s1, float eta, float* y) {
+    const float c = (1.f - eta) / (1.f + eta);
+    *y = c * s1 + s0 - c * *y;
+    return *y;
+}
 
-    // Handle tempo mode
-    float tempo = *self->tempo_host; 
-    switch ((int)(*self->tempo_mode)) {
-        case 1:
-            tempo = *self->tempo_user;
-            break;
-        case 2:
-            tempo = self->tempo_tap;
+/**
+* sample interpolation from buffer
+* \param buf pointer to the buffer
+* \param len length of the buffer, a power of two
+* \param valid number of recorded samples from the start of the buffer,
+*   everything behind reads as silence
+* \param x sample coordinate, within one buffer length around the start
+* \param interp interpolation mode
+* \param ap allpass state
+* \return interpolated sample
+*/
+static float interpolate(const tape_t *buf, uint32_t len, uint32_t valid,
+    double x, Interp interp, float* ap) {
+
+    // One buffer length keeps x positive, the mask does the rest
+    x += len;
+    const uint32_t xi = (uint32_t)x;
+    const float frac = x - (double)xi;
+    const uint32_t x0 = xi & (len - 1);
+    switch (interp) {
+        case INTERP_HERMITE:
+            return hermite(tape_at(buf, len, valid, x0 + len - 1),
+                tape_at(buf, len, valid, x0), tape_at(buf, len, valid, x0 + 1),
+                tape_at(buf, len, valid, x0 + 2), frac);
+        case INTERP_ALLPASS: {
+            uint32_t i0 = frac < 0.5f ? x0 : x0 + 1;
+            float eta = (float)(i0 - x0) + 1.f - frac;
+            return allpass(tape_at(buf, len, valid, i0), 
+                tape_at(buf, len, valid, i0 + 1), eta, ap);
+        }
+        case INTERP_LINEAR:
             break;
     }
+    float s0 = tape_at(buf, len, valid, x0);
+    float s1 = tape_at(buf, len, valid, x0 + 1);
+    return s0 + frac * (s1 - s0);
+}
 
-    // pull delay times from heap
-    double cur_d_t_ch1 = self->cur_d_t_ch1;
-    double cur_d_t_ch2 = self->cur_d_t_ch2;
-    double tgt_d_t_ch1 = self->tgt_d_t_ch1;
-    double tgt_d_t_ch2 = self->tgt_d_t_ch2;
-
-    // Tempo changes always initiate a fade out.
-    if ((tempo != self->cur_tempo ||
-        *self->div_l != self->cur_div_l ||
-        *self->div_r != self->cur_div_r)
-    ) {
-    	// Calculate the samples needed for the currently set delay time
-        self->tgt_d_t_ch1 = calc_delay_samples(self, tempo, *self->div_l);
-        self->tgt_d_t_ch2 = calc_delay_samples(self, tempo, *self->div_r);
-
-        // Memorize the user's current settings.
-        self->cur_tempo = tempo;
-        self->cur_div_l = *self->div_l;
-        self->cur_div_r = *self->div_r;
-
-        /* The buffer always needs to be one sample bigger than the delay 
-        time.  In order to not exceed MAX_TAPE_LEN, cut the number of 
-        samples, if needed */
-        if (self->tgt_d_t_ch1+1 > MAX_TAPE_LEN)
-            self->tgt_d_t_ch1 = MAX_TAPE_LEN-1;
+/**
+* Ways a segment can be read from the tape
+*/
+typedef enum {
+    LAP_DIRECT,     ///< all positions are recorded, no wrap-around
+    LAP_SILENT,     ///< all positions are behind the tape start, not recorded
+    LAP_SPLIT,      ///< positions need to be wrapped one by one
+} TapeLap;
 
-        if (self->tgt_d_t_ch2-1 > MAX_TAPE_LEN)
-            self->tgt_d_t_ch2 = MAX_TAPE_LEN-1;
-    }
+/**
+* Resolves the wrap-around of a tape segment once for all its positions.
+* \param len length of the buffer
+* \param full the buffer has been filled completely since activate
+* \param pos write position of the first sample of the segment
+* \param d_lo smallest delay time within the segment
+* \param d_hi biggest delay time within the segment
+* \param n number of samples, must be smaller than every delay time
+* \param interp interpolation mode, sets the samples needed around a position
+* \param base receives the position to subtract the delay times from
+* \return how to read the segment
+*/
+static TapeLap tape_lap(uint32_t len, bool full, uint32_t pos,
+    double d_lo, double d_hi, uint32_t n, Interp interp, uint32_t* base) {
 
-    // Let's do the vfade gain calculation
-    const float cp_blend = *self->mix;
-    float target_dry_gain = 1;
-    float target_wet_gain = 0;
-    if (cp_blend > 0 && cp_blend < 50) {
-        target_wet_gain = powf(10.0f, (cp_blend-50) * 0.04f);
-    }
-    else if (cp_blend < 100 && cp_blend > 50) {
-        target_wet_gain = 1;
-        target_dry_gain = powf(10.0f, (cp_blend-50) * -0.04f);
+    // Hermite and allpass read one sample further on both sides
+    if (interp != INTERP_LINEAR) {
+        d_lo -= 1;
+        d_hi += 1;
     }
-    else if (cp_blend == 50) {
-        target_wet_gain = 1;
+    if (d_lo > n && (double)pos - d_hi >= 0) {
+        *base = pos;
+        return LAP_DIRECT;
     }
-    else if (cp_blend == 100) {
-        target_wet_gain = 1;
-        target_dry_gain = 0;
+    if (d_lo > n && (double)(pos + n + 1) - d_lo < 0) {
+        // Positions before the tape start haven't been recorded yet
+        if (!full)
+            return LAP_SILENT;
+        *base = pos + len;
+        return LAP_DIRECT;
     }
+    return LAP_SPLIT;
+}
 
-    // Lets do the feedback/crossfeed calculation        
-    const float cp_feedback = *self->feedback;
-    float target_feedback = 0;
-    if (cp_feedback > 0 && cp_feedback < 100) {
-        target_feedback = powf(10.0f, (cp_feedback-100) * 0.02f);
-    }
-    else if (cp_feedback == 100) {
-        target_feedback = 1;
-    }
+/**
+* Read position as 32.32 fixed point, the integer part in the upper half
+*/
+typedef int64_t phase_t;
 
-    const float cp_crossf = *self->crossf;
-    float target_crossf = 0;
-    if (cp_crossf > 0 && cp_crossf < 100) {
-        target_crossf = powf(10.0f, (cp_crossf-100) * 0.02f);
-    }
-    else if (cp_feedback == 100) {
-        target_crossf = 1;
-    }
+#define PHASE_ONE 4294967296.0  ///< phase_t of one sample
 
-    // State stuff to get more from heap to stack
-    float dry_gain = self->dry_gain;
-    float wet_gain = self->wet_gain;
-    float cur_feedback = self->cur_feedback;
-    float cur_crossf = self->cur_crossf;
-    int pos_w = self->pos_w;
+/**
+* Converts a position to a phase.
+*/
+static inline phase_t to_phase(double x) {
+    return (phase_t)(x * PHASE_ONE);
+}
 
-    // Loop over the block of audio we got
-    for (unsigned int i = 0 ; i < n_samples ; ++i) {
+/**
+* Fraction of a phase between its sample and the next one.
+*/
+static inline float phase_frac(phase_t x) {
+    return (float)(uint32_t)x * (float)(1.0 / PHASE_ONE);
+}
 
-        // Current samples
-        float cur_fs_l = self->input_l[i];
-        float cur_fs_r = self->input_r[i];
+/**
+* Delay time moving along a segment,
+* d + step * i + curve * i^2 + bend * i^3 at sample i
+*/
+typedef struct {
+    double d;           ///< delay time of the first sample
+    double step;        ///< change per sample
+    double curve;       ///< change of the step per sample, halved
+    double bend;        ///< change of the curve per sample, divided by 3
+} DelaySlide;
 
-        // Previous samples
-        float old_s_l = 0;
-        float old_s_r = 0;
+/**
+* Delay time at a position within a segment.
+*/
+static inline double slide_at(const DelaySlide* s, double i) {
+    return s->d + (s->step + (s->curve + s->bend * i) * i) * i;
+}
 
-	// calculate fractional sample position. function interpolate will
-	// handle wrap-arounds on its own
-	double x = (double)pos_w - cur_d_t_ch1;
-        old_s_l = interpolate(self->buffer_l, x);
-	x = (double)pos_w - cur_d_t_ch2;
-        old_s_r = interpolate(self->buffer_r, x);
-    
-        // Apply the low cut filter if enabled
-        if (*self->low_on) {
-            cur_fs_l = bf_lcf(
-                cur_fs_l, 
-                *self->low_f, 
-                *self->low_q, 
-                self->rate, 
-                &self->filter_low_l
-            );
-            cur_fs_r = bf_lcf(
-                cur_fs_r, 
-                *self->low_f, 
-                *self->low_q, 
-                self->rate, 
-                &self->filter_low_r
-            );
+/**
+* Widens a range by the delay time at a position, if it lies within the
+* segment.
+*/
+static inline void slide_extend(const DelaySlide* s, double v, uint32_t n,
+    double* lo, double* hi) {
+
+    if (v > 0 && v < n - 1) {
+        const double d_v = slide_at(s, v);
+        if (d_v < *lo) *lo = d_v;
+        if (d_v > *hi) *hi = d_v;
+    }
+}
+
+/**
+* Smallest and biggest delay time along a segment. A modulated delay time
+* can turn within the segment.
+* \param s delay time along the segment
+* \param n number of samples
+* \param lo receives the smallest delay time
+* \param hi receives the biggest delay time
+*/
+static inline void slide_range(const DelaySlide* s, uint32_t n, double* lo,
+    double* hi) {
+
+    const double d_last = slide_at(s, n - 1);
+    *lo = s->d < d_last ? s->d : d_last;
+    *hi = s->d < d_last ? d_last : s->d;
+
+    // Turning points, where step + 2 * curve * v + 3 * bend * v^2 is 0
+    const double a = 3 * s->bend;
+    const double b = 2 * s->curve;
+    const double disc = b * b - 4 * a * s->step;
+    if (disc < 0 || (a == 0 && b == 0))
+        return;
+    const double q = -0.5 * (b + (b < 0 ? -sqrt(disc) : sqrt(disc)));
+    if (a != 0)
+        slide_extend(s, q / a, n, lo, hi);
+    if (q != 0)
+        slide_extend(s, s->step / q, n, lo, hi);
+}
+
+/**
+* Reads one segment from the tape with the delay time sliding.
+* Within a segment the delay time follows a cubic, so the read position
+* is a fixed-point phase stepped with forward differences, and the inner
+* loop only needs integer adds.
+* As long as all positions of the segment lie on one side of the tape start,
+* the wrap-around is resolved once for the whole segment and the inner loop
+* doesn't branch. Only segments crossing the start are interpolated sample by
+* sample.
+* \param buf pointer to the buffer
+* \param len length of the buffer
+* \param full the buffer has been filled completely since activate
+* \param pos write position of the first sample of the segment
+* \param s delay time along the segment
+* \param n number of samples, must be smaller than every delay time
+* \param interp interpolation mode
+* \param ap allpass state
+* \param out interpolated samples
+*/
+static void read_tape(const tape_t* buf, uint32_t len, bool full,
+    uint32_t pos, const DelaySlide* s, uint32_t n, Interp interp, 
+    float* ap, float* out) {
+
+    const double d = s->d;
+    double d_lo;
+    double d_hi;
+    slide_range(s, n, &d_lo, &d_hi);
+    uint32_t base = 0;
+
+    switch (tape_lap(len, full, pos, d_lo, d_hi, n, interp, &base)) {
+        case LAP_SILENT:
+            for (uint32_t i = 0 ; i < n ; ++i)
+                out[i] = 0;
+            *ap = 0;
+            return;
+        case LAP_SPLIT:
+            for (uint32_t i = 0 ; i < n ; ++i) {
+                uint32_t valid = full ? len : pos + i;
+                out[i] = interpolate(buf, len, valid, 
+                    (double)(pos + i) - slide_at(s, i), interp, ap);
+            }
+            return;
+        case LAP_DIRECT:
+            break;
+    }
+
+    phase_t x = to_phase((double)base - d);
+    phase_t inc = to_phase(1 - s->step - s->curve - s->bend);
+    phase_t acc = to_phase(-2 * s->curve - 6 * s->bend);
+    const phase_t jerk = to_phase(-6 * s->bend);
+    switch (interp) {
+        case INTERP_LINEAR:
+            for (uint32_t i = 0 ; i < n ;
+                ++i, x += inc, inc += acc, acc += jerk) {
+                const tape_t* b = buf + TAPE_STRIDE * (uint32_t)(x >> 32);
+                const float s0 = tape_load(b[0]);
+                out[i] = s0 + phase_frac(x) * (tape_load(b[TAPE_STRIDE]) - s0);
+            }
+            break;
+        case INTERP_HERMITE:
+            for (uint32_t i = 0 ; i < n ;
+                ++i, x += inc, inc += acc, acc += jerk) {
+                const tape_t* b = buf + TAPE_STRIDE * (uint32_t)(x >> 32);
+                out[i] = hermite(tape_load(b[-TAPE_STRIDE]), tape_load(b[0]),
+                    tape_load(b[TAPE_STRIDE]), tape_load(b[2 * TAPE_STRIDE]),
+                    phase_frac(x));
+            }
+            break;
+        case INTERP_ALLPASS: {
+            // The newer sample is the one after the nearest position
+            float y = *ap;
+            x += to_phase(0.5);
+            for (uint32_t i = 0 ; i < n ;
+                ++i, x += inc, inc += acc, acc += jerk) {
+                const tape_t* b = buf + TAPE_STRIDE * (uint32_t)(x >> 32);
+                out[i] = allpass(tape_load(b[0]), tape_load(b[TAPE_STRIDE]), 
+                    1.5f - phase_frac(x), &y);
+            }
+            *ap = y;
+            break;
+        }
+    }
+}
+
+/**
+* Reads one segment from both tapes, when both channels use the same sliding
+* delay time. Positions and fractions are calculated once for both channels.
+* \param buf_l pointer to the left buffer
+* \param buf_r pointer to the right buffer
+* \param len length of the buffers
+* \param full the buffers have been filled completely since activate
+* \param pos write position of the first sample of the segment
+* \param s delay time along the segment
+* \param n number of samples, must be smaller than every delay time
+* \param interp interpolation mode
+* \param ap_l allpass state, left side
+* \param ap_r allpass state, right side
+* \param out_l interpolated samples, left side
+* \param out_r interpolated samples, right side
+*/
+static void read_tape_pair(const tape_t* buf_l, const tape_t* buf_r,
+    uint32_t len, bool full, uint32_t pos, const DelaySlide* s, uint32_t n,
+    Interp interp, float* ap_l, float* ap_r, float* out_l, float* out_r) {
+
+    const double d = s->d;
+    double d_lo;
+    double d_hi;
+    slide_range(s, n, &d_lo, &d_hi);
+    uint32_t base = 0;
+
+    if (interp == INTERP_ALLPASS || 
+        tape_lap(len, full, pos, d_lo, d_hi, n, interp, &base) != LAP_DIRECT) {
+        read_tape(buf_l, len, full, pos, s, n, interp, ap_l, out_l);
+        read_tape(buf_r, len, full, pos, s, n, interp, ap_r, out_r);
+        return;
+    }
+
+    phase_t x = to_phase((double)base - d);
+    phase_t inc = to_phase(1 - s->step - s->curve - s->bend);
+    phase_t acc = to_phase(-2 * s->curve - 6 * s->bend);
+    const phase_t jerk = to_phase(-6 * s->bend);
+    if (interp == INTERP_HERMITE) {
+        for (uint32_t i = 0 ; i < n ; ++i, x += inc, inc += acc, acc += jerk) {
+            const uint32_t x0 = TAPE_STRIDE * (uint32_t)(x >> 32);
+            const float frac = phase_frac(x);
+            const tape_t* l = buf_l + x0;
+            const tape_t* r = buf_r + x0;
+            out_l[i] = hermite(tape_load(l[-TAPE_STRIDE]), tape_load(l[0]), 
+                tape_load(l[TAPE_STRIDE]), tape_load(l[2 * TAPE_STRIDE]), 
+                frac);
+            out_r[i] = hermite(tape_load(r[-TAPE_STRIDE]), tape_load(r[0]), 
+                tape_load(r[TAPE_STRIDE]), tape_load(r[2 * TAPE_STRIDE]), 
+                frac);
+        }
+        return;
+    }
+
+    for (uint32_t i = 0 ; i < n ; ++i, x += inc, inc += acc, acc += jerk) {
+        const uint32_t x0 = TAPE_STRIDE * (uint32_t)(x >> 32);
+        const float frac = phase_frac(x);
+        const tape_t* l = buf_l + x0;
+        const tape_t* r = buf_r + x0;
+        const float l0 = tape_load(l[0]);
+        const float r0 = tape_load(r[0]);
+        out_l[i] = l0 + frac * (tape_load(l[TAPE_STRIDE]) - l0);
+        out_r[i] = r0 + frac * (tape_load(r[TAPE_STRIDE]) - r0);
+    }
+}
+
+/**
+* Reads one segment from the tape with a constant delay time.
+* The segment is read from consecutive positions with the same fraction, so
+* the loop vectorizes. A delay time of whole samples is a plain copy.
+* \param buf pointer to the buffer
+* \param len length of the buffer
+* \param full the buffer has been filled completely since activate
+* \param pos write position of the first sample of the segment
+* \param d delay time
+* \param n number of samples, must be smaller than the delay time
+* \param interp interpolation mode
+* \param ap allpass state
+* \param out interpolated samples
+*/
+static void read_tape_fixed(const tape_t* buf, uint32_t len, bool full,
+    uint32_t pos, double d, uint32_t n, Interp interp, float* ap, float* out) {
+
+    uint32_t base = 0;
+
+    switch (tape_lap(len, full, pos, d, d, n, interp, &base)) {
+        case LAP_SILENT:
+            for (uint32_t i = 0 ; i < n ; ++i)
+                out[i] = 0;
+            *ap = 0;
+            return;
+        case LAP_SPLIT:
+            for (uint32_t i = 0 ; i < n ; ++i) {
+                uint32_t valid = full ? len : pos + i;
+                out[i] = interpolate(buf, len, valid, (double)(pos + i) - d,
+                    interp, ap);
+            }
+            return;
+        case LAP_DIRECT:
+            break;
+    }
+
+    double x = (double)base - d;
+    const tape_t* b = buf + TAPE_STRIDE * (uint32_t)x;
+    const float frac = x - (double)(uint32_t)x;
+    if (frac == 0) {
+        /* Every mode reads the samples as they are, the allpass settles.
+        For a float tape this is a plain copy. */
+        for (uint32_t i = 0 ; i < n ; ++i)
+            out[i] = tape_load(b[TAPE_STRIDE * i]);
+        *ap = out[n-1];
+        return;
+    }
+
+    switch (interp) {
+        case INTERP_LINEAR:
+            for (uint32_t i = 0 ; i < n ; ++i) {
+                const float s0 = tape_load(b[TAPE_STRIDE * i]);
+                out[i] = s0 + frac * (tape_load(b[TAPE_STRIDE * (i+1)]) - s0);
+            }
+            break;
+        case INTERP_HERMITE: {
+            // Constant fraction, so the polynomial is a 4-tap FIR
+            const float t = frac;
+            const float cm1 = t * (-0.5f + t * (1.f - 0.5f * t));
+            const float c0 = 1.f + t * t * (-2.5f + 1.5f * t);
+            const float c1 = t * (0.5f + t * (2.f - 1.5f * t));
+            const float c2 = t * t * (-0.5f + 0.5f * t);
+            const tape_t* bm1 = b - TAPE_STRIDE;
+            const tape_t* b1 = b + TAPE_STRIDE;
+            const tape_t* b2 = b + 2 * TAPE_STRIDE;
+            for (uint32_t i = 0 ; i < n ; ++i) {
+                const uint32_t k = TAPE_STRIDE * i;
+                out[i] = cm1 * tape_load(bm1[k]) + c0 * tape_load(b[k]) 
+                    + c1 * tape_load(b1[k]) + c2 * tape_load(b2[k]);
+            }
+            break;
+        }
+        case INTERP_ALLPASS: {
+            const uint32_t k = frac < 0.5f ? 0 : 1;
+            const float eta = (float)k + 1.f - frac;
+            float y = *ap;
+            for (uint32_t i = 0 ; i < n ; ++i)
+                out[i] = allpass(tape_load(b[TAPE_STRIDE * (i+k)]), 
+                    tape_load(b[TAPE_STRIDE * (i+k+1)]), eta, &y);
+            *ap = y;
+            break;
+        }
+    }
+}
+
+/**
+* Parameters of the tape kernel, moving towards their targets.
+*/
+typedef struct {
+    double d_l;             ///< current delay time, left side
+    double d_r;             ///< current delay time, right side
+    double tgt_d_l;         ///< target delay time, left side
+    double tgt_d_r;         ///< target delay time, right side
+    float feedback;         ///< current feedback gain
+    float crossf;           ///< current crossfeed gain
+    float wet_gain;         ///< current wet gain
+    float dry_gain;         ///< current dry gain
+    float tgt_feedback;     ///< target feedback gain
+    float tgt_crossf;       ///< target crossfeed gain
+    float tgt_wet_gain;     ///< target wet gain
+    float tgt_dry_gain;     ///< target dry gain
+    Interp interp;          ///< interpolation mode
+    float ap_l;             ///< allpass interpolator state, left side
+    float ap_r;             ///< allpass interpolator state, right side
+    double mod_depth;       ///< current modulation depth in samples
+    double tgt_mod_depth;   ///< target modulation depth in samples
+    const float* mod_wave;  ///< one cycle of the LFO shape
+    uint32_t mod_phase;     ///< LFO phase, a cycle spans the whole range
+    uint32_t mod_inc;       ///< LFO phase increment per sample
+    uint32_t mod_spread;    ///< LFO phase of the right side ahead of the left
+} KernelParams;
+
+/**
+* Smoothing coefficients per sample and the distance to the target, below
+* which a smoother snaps to it
+*/
+#define SMOOTH_DELAY    0.001   ///< delay times
+#define SMOOTH_GAIN     0.01f   ///< gains
+#define SETTLE_DELAY    1e-4    ///< delay times in samples
+#define SETTLE_GAIN     1e-6f   ///< gains
+
+/**
+* Mode bits selecting a specialized tape kernel
+*/
+#define KERNEL_SMOOTH   1   ///< gains are still moving
+#define KERNEL_CROSSF   2   ///< crossfeed is in use
+#define KERNEL_SPLIT    4   ///< left and right delay times differ
+#define KERNEL_SLIDE    8   ///< delay times are still moving
+#define KERNEL_MODES    16
+
+/**
+* Snaps a smoothed value to its target once it is close enough.
+* \param cur current value
+* \param tgt target value
+* \param eps distance to snap at
+* \return true if the value sits on its target
+*/
+static bool settle(double* cur, double tgt, double eps) {
+    if (fabs(tgt - *cur) < eps)
+        *cur = tgt;
+    return *cur == tgt;
+}
+
+/**
+* Same as above for gain smoothers.
+*/
+static bool settle_gain(float* cur, float tgt) {
+    if (fabsf(tgt - *cur) < SETTLE_GAIN)
+        *cur = tgt;
+    return *cur == tgt;
+}
+
+/**
+* Returns how much of the distance to its target a delay time smoother
+* keeps over a number of samples, (1 - SMOOTH_DELAY)^n. The smoother runs
+* at the full rate, a decimated wet path passes decim samples per tape sample.
+* \param n number of samples at the full rate
+*/
+static double slide_decay(uint32_t n) {
+    double k = 1;
+    for (double b = 1 - SMOOTH_DELAY ; n ; n >>= 1, b *= b)
+        if (n & 1)
+            k *= b;
+    return k;
+}
+
+/**
+* Fits a cubic to a smoothed delay time over one segment. It meets the
+* smoother exactly at the start, after each third and at the end of the
+* segment, in between it is off by less than 1e-8 of the distance to the
+* target. The smoothing runs per segment instead of per sample.
+* \param d current delay time
+* \param tgt target delay time
+* \param k slide_decay() of the segment length
+* \param n number of samples of the segment
+* \param mod modulation at the start, the middle and the end or NULL, a
+*   parabola through it is added to the delay time along the segment
+* \param s receives the delay time along the segment
+* \return delay time at the end of the segment, without the modulation
+*/
+static double slide_segment(double d, double tgt, double k, uint32_t n,
+    const double* mod, DelaySlide* s) {
+
+    // Forward differences over thirds of the segment
+    const double end = tgt + (d - tgt) * k;
+    const double k3 = cbrt(k);
+    const double p1 = tgt + (d - tgt) * k3;
+    const double p2 = tgt + (d - tgt) * k3 * k3;
+    const double d1 = p1 - d;
+    const double d2 = p2 - 2 * p1 + d;
+    const double d3 = end - 3 * p2 + 3 * p1 - d;
+    const double h = n / 3.0;
+    s->d = d;
+    s->step = (d1 - 0.5 * d2 + d3 / 3) / h;
+    s->curve = 0.5 * (d2 - d3) / (h * h);
+    s->bend = d3 / (6 * h * h * h);
+
+    if (mod) {
+        const double curve = 2 * (mod[2] - 2 * mod[1] + mod[0]) / 
+            ((double)n * n);
+        s->d += mod[0];
+        s->step += (mod[2] - mod[0]) / n - curve * n;
+        s->curve += curve;
+    }
+    return end;
+}
+
+/**
+* Looks up the LFO at a phase, interpolating linearly.
+*/
+static inline float lfo_at(const float* wave, uint32_t phase) {
+    const uint32_t i = phase >> (32 - MOD_TABLE_BITS);
+    const float frac =
+        (float)(phase << MOD_TABLE_BITS) * (float)(1.0 / PHASE_ONE);
+    return wave[i] + frac * (wave[i + 1] - wave[i]);
+}
+
+/**
+* Advances the modulation over one segment. The LFO is only looked up at
+* the start, the middle and the end of the segment, slide_segment() lays the
+* parabola through these points.
+* The depth is limited, so that the modulated delay times keep at least half
+* of the shortest delay time and stay on the tape. A parabola through three
+* points stays within 1.25 times their biggest value.
+* \param kp current kernel parameters
+* \param len length of the tape
+* \param k slide_decay() of the segment length
+* \param n number of samples of the segment
+* \param mod_l receives the modulation of the left side
+* \param mod_r receives the modulation of the right side
+*/
+static void lfo_segment(KernelParams* kp, uint32_t len, double k, uint32_t n,
+    double* mod_l, double* mod_r) {
+
+    double d_lo = kp->d_l < kp->d_r ? kp->d_l : kp->d_r;
+    double d_hi = kp->d_l < kp->d_r ? kp->d_r : kp->d_l;
+    if (kp->tgt_d_l < d_lo) d_lo = kp->tgt_d_l;
+    if (kp->tgt_d_r < d_lo) d_lo = kp->tgt_d_r;
+    if (kp->tgt_d_l > d_hi) d_hi = kp->tgt_d_l;
+    if (kp->tgt_d_r > d_hi) d_hi = kp->tgt_d_r;
+    double room = 0.5 * d_lo;
+    if (len - 2 - d_hi < room)
+        room = len - 2 - d_hi;
+    room *= 0.8;
+
+    const double first = kp->mod_depth;
+    const double last = kp->tgt_mod_depth + (first - kp->tgt_mod_depth) * k;
+    const double depth[3] = { first, 0.5 * (first + last), last };
+    const uint32_t phase[3] = { kp->mod_phase,
+        kp->mod_phase + (uint32_t)((uint64_t)kp->mod_inc * n / 2),
+        kp->mod_phase + kp->mod_inc * n };
+    for (int j = 0 ; j < 3 ; ++j) {
+        double a = depth[j] < room ? depth[j] : room;
+        if (a < 0)
+            a = 0;
+        mod_l[j] = a * lfo_at(kp->mod_wave, phase[j]);
+        mod_r[j] = a * lfo_at(kp->mod_wave, phase[j] + kp->mod_spread);
+    }
+    kp->mod_depth = last;
+    kp->mod_phase = phase[2];
+}
+
+/**
+* Finds the kernel mode for the current parameters.
+* Smoothers that converged are snapped to their targets, from then on the
+* kernel treats them as constants until the next control change.
+* \param kp current kernel parameters
+* \return mode bits
+*/
+static unsigned int kernel_mode(KernelParams* kp) {
+    unsigned int mode = 0;
+
+    // Evaluate every smoother, so each of them snaps on its own
+    bool fixed = settle(&kp->d_l, kp->tgt_d_l, SETTLE_DELAY);
+    fixed = settle(&kp->d_r, kp->tgt_d_r, SETTLE_DELAY) && fixed;
+    if (!fixed)
+        mode |= KERNEL_SLIDE;
+
+    // Modulation keeps the delay times moving
+    settle(&kp->mod_depth, kp->tgt_mod_depth, SETTLE_DELAY);
+    const bool mod = kp->mod_depth != 0 || kp->tgt_mod_depth != 0;
+    if (mod)
+        mode |= KERNEL_SLIDE;
+
+    fixed = settle_gain(&kp->feedback, kp->tgt_feedback);
+    fixed = settle_gain(&kp->crossf, kp->tgt_crossf) && fixed;
+    fixed = settle_gain(&kp->wet_gain, kp->tgt_wet_gain) && fixed;
+    fixed = settle_gain(&kp->dry_gain, kp->tgt_dry_gain) && fixed;
+    if (!fixed)
+        mode |= KERNEL_SMOOTH;
+
+    if (kp->crossf != 0 || kp->tgt_crossf != 0)
+        mode |= KERNEL_CROSSF;
+
+    if (kp->d_l != kp->d_r || kp->tgt_d_l != kp->tgt_d_r ||
+        (mod && kp->mod_spread))
+        mode |= KERNEL_SPLIT;
+
+    return mode;
+}
+
+/**
+* Reads a segment with every audible additional head and adds it to the wet
+* signal. Silent heads jump to their delay time instead of sliding.
+* \param self pointer to current plugin instance
+* \param interp interpolation mode
+* \param pos write position of the first sample of the segment
+* \param full the tape has been filled completely since activate
+* \param n number of samples, must be smaller than every delay time
+* \param wet_l wet samples, left side
+* \param wet_r wet samples, right side
+*/
+static void read_heads(BollieDelay* self, Interp interp, uint32_t pos,
+    bool full, uint32_t n, float* wet_l, float* wet_r) {
+
+    const uint32_t len = self->tape_len;
+    for (int h = 0 ; h < TAP_HEADS ; ++h) {
+        BollieHead* hd = &self->heads[h];
+        bool fixed = settle_gain(&hd->gain_l, hd->tgt_gain_l);
+        fixed = settle_gain(&hd->gain_r, hd->tgt_gain_r) && fixed;
+        if (fixed && hd->gain_l == 0 && hd->gain_r == 0) {
+            hd->d = hd->tgt_d;
+            continue;
+        }
+
+        float s_l[KERNEL_LEN];
+        float s_r[KERNEL_LEN];
+        if (settle(&hd->d, hd->tgt_d, SETTLE_DELAY)) {
+            read_tape_fixed(self->buffer_l, len, full, pos, hd->d, n, interp,
+                &hd->ap_l, s_l);
+            read_tape_fixed(self->buffer_r, len, full, pos, hd->d, n, interp,
+                &hd->ap_r, s_r);
+        }
+        else {
+            DelaySlide s;
+            const double k = slide_decay(n * self->decim);
+            hd->d = slide_segment(hd->d, hd->tgt_d, k, n, NULL, &s);
+            read_tape_pair(self->buffer_l, self->buffer_r, len, full, pos, &s,
+                n, interp, &hd->ap_l, &hd->ap_r, s_l, s_r);
+        }
+
+        float gain_l = hd->gain_l;
+        float gain_r = hd->gain_r;
+        if (fixed) {
+            for (uint32_t j = 0 ; j < n ; ++j) {
+                wet_l[j] += gain_l * s_l[j];
+                wet_r[j] += gain_r * s_r[j];
+            }
+        }
+        else {
+            for (uint32_t j = 0 ; j < n ; ++j) {
+                gain_l += (hd->tgt_gain_l - gain_l) * SMOOTH_GAIN;
+                gain_r += (hd->tgt_gain_r - gain_r) * SMOOTH_GAIN;
+                wet_l[j] += gain_l * s_l[j];
+                wet_r[j] += gain_r * s_r[j];
+            }
+        }
+        hd->gain_l = gain_l;
+        hd->gain_r = gain_r;
+    }
+}
+
+/**
+* Tape kernel: reads a segment from the tape, records the input together with
+* feedback and crossfeed and blends the output. Every combination of mode
+* bits is compiled into its own function, so work not needed by a mode is
+* removed at compile time.
+* \param self pointer to current plugin instance
+* \param kp current kernel parameters, updated for the next segment
+* \param src_l samples to record, left side
+* \param src_r samples to record, right side
+* \param dry_l dry input samples, left side
+* \param dry_r dry input samples, right side
+* \param out_l output samples, left side
+* \param out_r output samples, right side
+* \param pos write position of the first sample of the segment
+* \param full the tape has been filled completely since activate
+* \param n number of samples, must be smaller than every delay time
+* \param mode mode bits, a compile time constant
+*/
+static inline __attribute__((always_inline)) void kernel(BollieDelay* self,
+    KernelParams* kp, const float* src_l, const float* src_r,
+    const float* dry_l, const float* dry_r, float* out_l, float* out_r,
+    uint32_t pos, bool full, uint32_t n, const unsigned int mode) {
+
+    const uint32_t len = self->tape_len;
+    float old_s_l[KERNEL_LEN];  // samples read from the tape
+    float old_s_r[KERNEL_LEN];
+
+    if (mode & KERNEL_SLIDE) {
+        // delay time smoothing, once for the segment
+        const double k = slide_decay(n * self->decim);
+        double mod_l[3];
+        double mod_r[3];
+        const bool mod = kp->mod_depth != 0 || kp->tgt_mod_depth != 0;
+        if (mod)
+            lfo_segment(kp, len, k, n, mod_l, mod_r);
+
+        DelaySlide s_l;
+        DelaySlide s_r;
+        kp->d_l = slide_segment(kp->d_l, kp->tgt_d_l, k, n,
+            mod ? mod_l : NULL, &s_l);
+
+        if (mode & KERNEL_SPLIT) {
+            kp->d_r = slide_segment(kp->d_r, kp->tgt_d_r, k, n,
+                mod ? mod_r : NULL, &s_r);
+            read_tape(self->buffer_l, len, full, pos, &s_l, n, kp->interp,
+                &kp->ap_l, old_s_l);
+            read_tape(self->buffer_r, len, full, pos, &s_r, n, kp->interp,
+                &kp->ap_r, old_s_r);
+        }
+        else {
+            kp->d_r = kp->d_l;
+            read_tape_pair(self->buffer_l, self->buffer_r, len, full, pos,
+                &s_l, n, kp->interp, &kp->ap_l, &kp->ap_r, old_s_l, old_s_r);
+        }
+    }
+    else {
+        read_tape_fixed(self->buffer_l, len, full, pos, kp->d_l, n, 
+            kp->interp, &kp->ap_l, old_s_l);
+        read_tape_fixed(self->buffer_r, len, full, pos, kp->d_r, n, 
+            kp->interp, &kp->ap_r, old_s_r);
+    }
+
+    /* Feedback and Crossfeed filling the buffer */
+    tape_t* w_l = self->buffer_l + TAPE_STRIDE * pos;
+    tape_t* w_r = self->buffer_r + TAPE_STRIDE * pos;
+    float cur_feedback = kp->feedback;
+    float cur_crossf = kp->crossf;
+    for (uint32_t j = 0 ; j < n ; ++j) {
+        // parameter smoothing for feedback/crossfeed
+        if (mode & KERNEL_SMOOTH) {
+            cur_feedback += (kp->tgt_feedback - cur_feedback) * SMOOTH_GAIN;
+            if (mode & KERNEL_CROSSF)
+                cur_crossf += (kp->tgt_crossf - cur_crossf) * SMOOTH_GAIN;
+        }
+
+        if (mode & KERNEL_CROSSF) {
+            // Left Channel
+            w_l[TAPE_STRIDE * j] = tape_feed(src_l[j] // filtered sample
+                + old_s_r[j] * cur_crossf       // crossfeed sample
+                + old_s_l[j] * cur_feedback,    // feedback sample
+                src_l[j]);
+
+            // Right channel (s. above)
+            w_r[TAPE_STRIDE * j] = tape_feed(src_r[j]
+                + old_s_l[j] * cur_crossf
+                + old_s_r[j] * cur_feedback,
+                src_r[j]);
+        }
+        else {
+            w_l[TAPE_STRIDE * j] = 
+                tape_feed(src_l[j] + old_s_l[j] * cur_feedback, src_l[j]);
+            w_r[TAPE_STRIDE * j] = 
+                tape_feed(src_r[j] + old_s_r[j] * cur_feedback, src_r[j]);
+        }
+    }
+    kp->feedback = cur_feedback;
+    kp->crossf = cur_crossf;
+    /* end of buffer handling */
+
+    // The additional heads only add to the output
+    const float* wet_l = old_s_l;
+    const float* wet_r = old_s_r;
+    float heads_l[KERNEL_LEN];
+    float heads_r[KERNEL_LEN];
+    if (self->heads_active) {
+        memcpy(heads_l, old_s_l, n * sizeof(float));
+        memcpy(heads_r, old_s_r, n * sizeof(float));
+        read_heads(self, kp->interp, pos, full, n, heads_l, heads_r);
+        wet_l = heads_l;
+        wet_r = heads_r;
+    }
+
+    float wet_gain = kp->wet_gain;
+    float dry_gain = kp->dry_gain;
+    for (uint32_t j = 0 ; j < n ; ++j) {
+        // Paraemter smoothing for wet and dry gain
+        if (mode & KERNEL_SMOOTH) {
+            wet_gain += (kp->tgt_wet_gain - wet_gain) * SMOOTH_GAIN;
+            dry_gain += (kp->tgt_dry_gain - dry_gain) * SMOOTH_GAIN;
+        }
+
+        // Will it blend? ;)
+        out_l[j] = dry_gain * dry_l[j] + wet_gain * wet_l[j];
+        out_r[j] = dry_gain * dry_r[j] + wet_gain * wet_r[j];
+    }
+    kp->wet_gain = wet_gain;
+    kp->dry_gain = dry_gain;
+}
+
+/**
+* Specialized tape kernel, see kernel()
+*/
+typedef void (*KernelFunc)(BollieDelay*, KernelParams*, const float*, 
+    const float*, const float*, const float*, float*, float*, uint32_t, 
+    bool, uint32_t);
+
+#define KERNEL_VARIANT(mode) \
+static void kernel_##mode(BollieDelay* self, KernelParams* kp, \
+    const float* src_l, const float* src_r, const float* dry_l, \
+    const float* dry_r, float* out_l, float* out_r, uint32_t pos, \
+    bool full, uint32_t n) { \
+    kernel(self, kp, src_l, src_r, dry_l, dry_r, out_l, out_r, pos, full, \
+        n, mode); \
+}
+
+KERNEL_VARIANT(0)
+KERNEL_VARIANT(1)
+KERNEL_VARIANT(2)
+KERNEL_VARIANT(3)
+KERNEL_VARIANT(4)
+KERNEL_VARIANT(5)
+KERNEL_VARIANT(6)
+KERNEL_VARIANT(7)
+KERNEL_VARIANT(8)
+KERNEL_VARIANT(9)
+KERNEL_VARIANT(10)
+KERNEL_VARIANT(11)
+KERNEL_VARIANT(12)
+KERNEL_VARIANT(13)
+KERNEL_VARIANT(14)
+KERNEL_VARIANT(15)
+
+static const KernelFunc kernels[KERNEL_MODES] = {
+    kernel_0, kernel_1, kernel_2, kernel_3,
+    kernel_4, kernel_5, kernel_6, kernel_7,
+    kernel_8, kernel_9, kernel_10, kernel_11,
+    kernel_12, kernel_13, kernel_14, kernel_15,
+};
+
+/**
+* Longest delay time any head reads with right now or is sliding to,
+* including how far the modulation can swing it.
+* \param self pointer to current plugin instance
+* \return delay time in samples
+*/
+static double longest_delay(BollieDelay* self) {
+    double d = self->cur_d_t_ch1;
+    if (self->cur_d_t_ch2 > d) d = self->cur_d_t_ch2;
+    if (self->tgt_d_t_ch1 > d) d = self->tgt_d_t_ch1;
+    if (self->tgt_d_t_ch2 > d) d = self->tgt_d_t_ch2;
+    for (int h = 0 ; h < TAP_HEADS ; ++h) {
+        if (self->heads[h].d > d) d = self->heads[h].d;
+        if (self->heads[h].tgt_d > d) d = self->heads[h].tgt_d;
+    }
+    return d + 1.25 * self->cur_mod_depth;
+}
+
+/**
+* Finds the peak level of some samples.
+* \param buf samples
+* \param n number of samples
+* \return peak level
+*/
+static float peak_level(const float* buf, uint32_t n) {
+    float peak = 0;
+    for (uint32_t i = 0 ; i < n ; ++i)
+        peak = fmaxf(peak, fabsf(buf[i]));
+    return peak;
+}
+
+/**
+* Same as above for tape samples.
+*/
+static float tape_peak(const tape_t* buf, uint32_t n) {
+    float peak = 0;
+    for (uint32_t i = 0 ; i < n ; ++i)
+        peak = fmaxf(peak, fabsf(tape_load(buf[TAPE_STRIDE * i])));
+    return peak;
+}
+
+/**
+* Starts a change of the tape, its length, write position or fill state.
+* save() may read them from another thread meanwhile, it takes a snapshot
+* only while the sequence count is even and unchanged.
+* \param self pointer to current plugin instance
+*/
+static inline void tape_change_begin(BollieDelay* self) {
+    __atomic_store_n(&self->tape_seq, self->tape_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/**
+* Ends a change started with tape_change_begin().
+* \param self pointer to current plugin instance
+*/
+static inline void tape_change_end(BollieDelay* self) {
+    __atomic_store_n(&self->tape_seq, self->tape_seq + 1, __ATOMIC_RELEASE);
+}
+
+/**
+* Publishes what save() stores besides the tape.
+* \param self pointer to current plugin instance
+*/
+static void publish_state(BollieDelay* self) {
+    tape_change_begin(self);
+    self->saved.delay_l = self->cur_d_t_ch1;
+    self->saved.delay_r = self->cur_d_t_ch2;
+    self->saved.longest = longest_delay(self);
+    self->saved.tempo_tap = self->tempo_tap;
+    self->saved.feedback = self->cur_feedback;
+    self->saved.crossf = self->cur_crossf;
+    self->saved.wet_gain = self->wet_gain;
+    self->saved.dry_gain = self->dry_gain;
+    self->saved.decim = self->decim;
+    tape_change_end(self);
+}
+
+/**
+* Bypasses the tape once input and everything the heads can read from the
+* tape have been silent. The tape is marked empty, so nothing of the faded
+* tail comes back once the input returns.
+* \param self pointer to current plugin instance
+* \param pos write position at the start of the block
+* \param n_tape number of samples the block recorded on the tape
+* \param n_samples number of frames in the block
+*/
+static void detect_silence(BollieDelay* self, uint32_t pos, uint32_t n_tape,
+    uint32_t n_samples) {
+
+    // The block wrote n_tape from pos on. The tape might have changed.
+    const uint32_t len = self->tape_len;
+    uint32_t n = n_tape < len ? n_tape : len;
+    if (pos >= len)
+        pos = 0;
+    uint32_t first = n < len - pos ? n : len - pos;
+
+    float peak = fmaxf(peak_level(self->input_l, n_samples), 
+        peak_level(self->input_r, n_samples));
+    peak = fmaxf(peak, tape_peak(self->buffer_l + TAPE_STRIDE * pos, first));
+    peak = fmaxf(peak, tape_peak(self->buffer_l, n - first));
+    peak = fmaxf(peak, tape_peak(self->buffer_r + TAPE_STRIDE * pos, first));
+    peak = fmaxf(peak, tape_peak(self->buffer_r, n - first));
+    if (peak >= SILENCE_LEVEL) {
+        self->quiet_frames = 0;
+        return;
+    }
+
+    self->quiet_frames += n_samples;
+    if (self->quiet_frames < (longest_delay(self) + 2) * self->decim)
+        return;
+
+    self->silent = true;
+    tape_change_begin(self);
+    self->tape_full = false;
+    self->pos_w = 0;
+    tape_change_end(self);
+    ++self->tape_epoch;
+    self->cur_d_t_ch1 = self->tgt_d_t_ch1;
+    self->cur_d_t_ch2 = self->tgt_d_t_ch2;
+    self->ap_l = 0;
+    self->ap_r = 0;
+    for (int h = 0 ; h < TAP_HEADS ; ++h) {
+        self->heads[h].d = self->heads[h].tgt_d;
+        self->heads[h].ap_l = 0;
+        self->heads[h].ap_r = 0;
+    }
+    bf_stereo_reset(&self->filter_low);
+    bf_stereo_reset(&self->filter_high);
+    br_reset(&self->resampler);
+}
+
+/**
+* Message between run() and the worker. A request for a longer tape carries
+* a snapshot of the recording, the worker copies the recorded part into
+* the new tape while run() goes on.
+*/
+typedef struct {
+    uint32_t len;       ///< tape length in samples, 0 to release the tape
+    tape_t* tape;       ///< tape to release or the new tape
+    const tape_t* from; ///< tape to copy from
+    uint32_t from_len;  ///< length of each channel of from
+    uint32_t pos;       ///< write position of the snapshot
+    uint32_t n;         ///< recorded samples behind pos
+    uint32_t epoch;     ///< tape_epoch of the snapshot
+    uint64_t written;   ///< tape_written of the snapshot
+} TapeWork;
+
+/**
+* Copies samples of both channels from one tape to another. The source may
+* wrap around its end, the destination doesn't.
+* \param to destination tape
+* \param to_len length of each channel of the destination
+* \param at first destination position
+* \param from source tape
+* \param from_len length of each channel of the source, at least n
+* \param start first source position, wrapped to the source length
+* \param n number of samples
+*/
+static void copy_tape(tape_t* to, uint32_t to_len, uint32_t at,
+    const tape_t* from, uint32_t from_len, uint32_t start, uint32_t n) {
+
+    start &= from_len - 1;
+    const uint32_t first = n < from_len - start ? n : from_len - start;
+#if defined(TAPE_INTERLEAVED)
+    // Both channels move together
+    memcpy(to + 2 * at, from + 2 * start, 2 * first * sizeof(tape_t));
+    memcpy(to + 2 * (at + first), from, 2 * (n - first) * sizeof(tape_t));
+#else
+    const tape_t* from_r = from + from_len;
+    tape_t* to_r = to + to_len;
+    memcpy(to + at, from + start, first * sizeof(tape_t));
+    memcpy(to + at + first, from, (n - first) * sizeof(tape_t));
+    memcpy(to_r + at, from_r + start, first * sizeof(tape_t));
+    memcpy(to_r + at + first, from_r, (n - first) * sizeof(tape_t));
+#endif
+}
+
+/**
+* Clears the start of both channels of a tape.
+* \param tape tape to clear
+* \param len length of each channel
+* \param n number of samples to clear
+*/
+static void clear_tape(tape_t* tape, uint32_t len, uint32_t n) {
+#if defined(TAPE_INTERLEAVED)
+    memset(tape, 0, 2 * n * sizeof(tape_t));
+#else
+    memset(tape, 0, n * sizeof(tape_t));
+    memset(tape + len, 0, n * sizeof(tape_t));
+#endif
+}
+
+/**
+* Switches recording to another tape. Recording continues at pos, the
+* positions before it hold the recorded samples.
+* \param self pointer to current plugin instance
+* \param tape new tape for both channels
+* \param len length of each channel of the new tape
+* \param pos write position on the new tape
+* \return the old tape
+*/
+static tape_t* use_tape(BollieDelay* self, tape_t* tape, uint32_t len,
+    uint32_t pos) {
+
+    tape_t* old = self->buffer_l;
+    tape_change_begin(self);
+    self->buffer_l = tape;
+    self->buffer_r = tape_right(tape, len);
+    self->tape_len = len;
+    self->pos_w = pos;
+    self->tape_full = false;
+    tape_change_end(self);
+    ++self->tape_epoch;
+
+    // Delay times clamped to the old tape can reach their targets now
+    self->cur_tempo = 0;
+    return old;
+}
+
+/**
+* Moves the recorded part of the tape to a longer tape, the oldest sample
+* first. Recording continues right behind it.
+* \param self pointer to current plugin instance
+* \param tape new tape for both channels
+* \param len length of each channel of the new tape, longer than the old one
+* \return the old tape
+*/
+static tape_t* swap_tape(BollieDelay* self, tape_t* tape, uint32_t len) {
+    const uint32_t len_old = self->tape_len;
+    const uint32_t n = self->tape_full ? len_old : (uint32_t)self->pos_w;
+    copy_tape(tape, len, 0, self->buffer_l, len_old,
+        (uint32_t)self->pos_w - n, n);
+    return use_tape(self, tape, len, n);
+}
+
+/**
+* Takes over a tape the worker filled with a snapshot of the recording. Only
+* what was recorded since the snapshot is copied, the rest of the snapshot
+* is in place already.
+* \param self pointer to current plugin instance
+* \param w response of the worker
+* \return the old tape
+*/
+static tape_t* take_tape(BollieDelay* self, const TapeWork* w) {
+    const uint32_t old_len = self->tape_len;
+    const uint64_t k = self->tape_written - w->written;
+    if (k >= old_len || w->n + k >= w->len)
+        return swap_tape(self, w->tape, w->len);  // the worker fell behind
+
+    /* Recording went on over the oldest part of the snapshot, maybe before
+    the worker got to it. The old tape doesn't hold it anymore either. */
+    const uint32_t n = w->n + (uint32_t)k;
+    if (n > old_len)
+        clear_tape(w->tape, w->len, n - old_len);
+    copy_tape(w->tape, w->len, w->n, self->buffer_l, old_len, w->pos,
+        (uint32_t)k);
+    return use_tape(self, w->tape, w->len, n);
+}
+
+/**
+* Replaces the tape with a longer one right away. Not real-time safe.
+* \param self pointer to current plugin instance
+* \param len requested length of each channel
+*/
+static void grow_tape(BollieDelay* self, uint32_t len) {
+    if (len > self->max_len)
+        len = self->max_len;
+    if (len <= self->tape_len)
+        return;
+
+    size_t size = 0;
+    tape_t* tape = (tape_t*)bt_alloc(tape_size(len), &size);
+    if (!tape)
+        return;
+    tape_t* old = swap_tape(self, tape, tape_fit(size));
+    // The worker might still copy from the old tape
+    if (self->resize_pending && old == self->resize_from)
+        self->stale[self->n_stale++] = old;
+    else
+        bt_free(old);
+}
+
+/**
+* Tells whether save() is reading the tape in another thread. The tape it
+* took a snapshot of must not be released until it is done.
+* \param self pointer to current plugin instance
+* \return true if a save() is reading
+*/
+static bool tape_read(BollieDelay* self) {
+    // Orders the switch to the new tape before the check
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return __atomic_load_n(&self->tape_readers, __ATOMIC_RELAXED) != 0;
+}
+
+/**
+* Hands a tape to the worker for release. If the worker queue is full or
+* save() might still read the tape, it is kept until the next try, see
+* STALE_TAPES for why there is always room.
+* \param self pointer to current plugin instance
+* \param tape tape to release
+*/
+static void release_tape(BollieDelay* self, tape_t* tape) {
+    const TapeWork w = { .len = 0, .tape = tape };
+    if (tape_read(self) || self->schedule->schedule_work(
+        self->schedule->handle, sizeof(w), &w) != LV2_WORKER_SUCCESS)
+        self->stale[self->n_stale++] = tape;
+}
+
+/**
+* Modulation depth from its port.
+* \param self pointer to current plugin instance
+* \return depth in samples at the tape rate
+*/
+static double mod_depth_target(BollieDelay* self) {
+    if (!self->mod_depth || *self->mod_depth <= 0)
+        return 0;
+    return *self->mod_depth * 0.001 * self->tape_rate;
+}
+
+/**
+* Longest delay time the current settings ask for, before clamping to the
+* tape length.
+* \param self pointer to current plugin instance
+* \param tempo Tempo in BPM
+* \return delay time in samples
+*/
+static double wanted_delay(BollieDelay* self, float tempo) {
+    double d = calc_delay_samples(self, tempo, *self->div_l);
+    double d_r = calc_delay_samples(self, tempo, *self->div_r);
+    if (d_r > d) d = d_r;
+    for (int h = 0 ; h < TAP_HEADS ; ++h) {
+        const BollieHead* hd = &self->heads[h];
+        if (!hd->gain || *hd->gain <= 0)
+            continue;
+        double d_h = calc_delay_samples(self, tempo, hd->div ? *hd->div : 0);
+        if (d_h > d) d = d_h;
+    }
+    return d + 1.25 * mod_depth_target(self);
+}
+
+/**
+* Asks the worker for a longer tape, if the delay times don't fit.
+* \param self pointer to current plugin instance
+* \param tempo Tempo in BPM
+*/
+static void request_tape(BollieDelay* self, float tempo) {
+    // Stale tapes might still be read by a resize in progress or save()
+    if (self->resize_pending)
+        return;
+    if (self->n_stale && !tape_read(self)) {
+        const uint32_t n_stale = self->n_stale;
+        self->n_stale = 0;
+        for (uint32_t i = 0 ; i < n_stale ; ++i)
+            release_tape(self, self->stale[i]);
+    }
+    if (self->n_stale || self->tape_len >= self->max_len)
+        return;
+
+    const double d = wanted_delay(self, tempo);
+    if (d + 1 <= self->tape_len)
+        return;
+
+    TapeWork w = {
+        .len = (uint32_t)ceil(d) + 2,
+        .from = self->buffer_l,
+        .from_len = self->tape_len,
+        .pos = (uint32_t)self->pos_w,
+        .n = self->tape_full ? self->tape_len : (uint32_t)self->pos_w,
+        .epoch = self->tape_epoch,
+        .written = self->tape_written,
+    };
+    if (w.len > self->max_len)
+        w.len = self->max_len;
+    if (self->schedule->schedule_work(self->schedule->handle, sizeof(w), &w)
+        == LV2_WORKER_SUCCESS) {
+        self->resize_pending = true;
+        self->resize_from = self->buffer_l;
+    }
+}
+
+/**
+* Picks the tempo according to the tempo mode. A tempo from time:Position
+* is dropped once the tempo_host port changes, then the port wins again.
+* \param self pointer to current plugin instance
+* \return tempo in BPM
+*/
+static float current_tempo(BollieDelay* self) {
+    switch ((int)(*self->tempo_mode)) {
+        case 1:
+            return *self->tempo_user;
+        case 2:
+            return self->tempo_tap;
+    }
+    /* Prefer the tempo delivered with time:Position, it is sample accurate.
+    Hosts may only send it on changes, so it holds until the port moves. */
+    if (self->host_bpm > 0 && *self->tempo_host == self->host_port)
+        return self->host_bpm;
+    self->host_bpm = 0;
+    return *self->tempo_host;
+}
+
+/**
+* Picks the interpolation mode from its port.
+* \param self pointer to current plugin instance
+* \return interpolation mode
+*/
+static Interp current_interp(BollieDelay* self) {
+    if (!self->interp)
+        return INTERP_LINEAR;
+    switch ((int)(*self->interp)) {
+        case 1:
+            return INTERP_HERMITE;
+        case 2:
+            return INTERP_ALLPASS;
+    }
+    return INTERP_LINEAR;
+}
+
+/**
+* Picks the LFO shape from its port.
+* \param self pointer to current plugin instance
+* \return LFO shape
+*/
+static ModShape current_mod_shape(BollieDelay* self) {
+    if (self->mod_shape && (int)(*self->mod_shape) == 1)
+        return MOD_CHORUS;
+    return MOD_TAPE;
+}
+
+/**
+* Calculates a target delay time.
+* \param self pointer to current plugin instance
+* \param tempo Tempo in BPM
+* \param div Divider enum
+* \param interp interpolation mode
+* \return delay time in samples
+*/
+static double delay_target(BollieDelay* self, float tempo, int div,
+    Interp interp) {
+
+    double d = calc_delay_samples(self, tempo, div);
+
+    /* The expensive interpolators are only needed while the delay
+    time slides. Settled on whole samples, the tape is just copied. */
+    if (interp != INTERP_LINEAR)
+        d = round(d);
+
+    /* The buffer always needs to be one sample bigger than the delay 
+    time.  In order to not exceed the tape length, cut the number of 
+    samples, if needed */
+    if (d+1 > self->tape_len)
+        d = self->tape_len-1;
+    return d;
+}
+
+/**
+* Calculates new target delay times, if tempo, dividers or the
+* interpolation mode changed.
+* \param self pointer to current plugin instance
+* \param tempo Tempo in BPM
+*/
+static void update_delay_times(BollieDelay* self, float tempo) {
+    const Interp interp = current_interp(self);
+    const bool retune = tempo != self->cur_tempo ||
+        (int)interp != self->cur_interp;
+
+    for (int h = 0 ; h < TAP_HEADS ; ++h) {
+        BollieHead* hd = &self->heads[h];
+        const float div = hd->div ? *hd->div : 0;
+        if (retune || div != hd->cur_div) {
+            hd->tgt_d = delay_target(self, tempo, div, interp);
+            hd->cur_div = div;
+        }
+    }
+
+    // Tempo changes always initiate a fade out.
+    if (retune ||
+        *self->div_l != self->cur_div_l ||
+        *self->div_r != self->cur_div_r
+    ) {
+    	// Calculate the samples needed for the currently set delay time
+        self->tgt_d_t_ch1 = delay_target(self, tempo, *self->div_l, interp);
+        self->tgt_d_t_ch2 = delay_target(self, tempo, *self->div_r, interp);
+
+        // Memorize the user's current settings.
+        self->cur_tempo = tempo;
+        self->cur_div_l = *self->div_l;
+        self->cur_div_r = *self->div_r;
+        self->cur_interp = interp;
+    }
+}
+
+/**
+* Picks the decimation factor of the wet path from its port.
+* \param self pointer to current plugin instance
+* \return 1, 2 or 4
+*/
+static unsigned int current_decimation(BollieDelay* self) {
+    if (!self->wet_rate)
+        return 1;
+    switch ((int)(*self->wet_rate)) {
+        case 1:
+            return 2;
+        case 2:
+            return 4;
+    }
+    return 1;
+}
+
+/**
+* Switches the wet path to another rate. What is on the tape was recorded
+* at the old rate, so the tape starts over empty and the delay times jump
+* to their targets for the new rate.
+* \param self pointer to current plugin instance
+* \param decim new decimation factor
+* \param tempo Tempo in BPM
+*/
+static void set_decimation(BollieDelay* self, unsigned int decim,
+    float tempo) {
+
+    self->decim = decim;
+    self->tape_rate = self->rate / decim;
+    br_init(&self->resampler, decim);
+    bf_stereo_reset(&self->filter_low);
+    bf_stereo_reset(&self->filter_high);
+    tape_change_begin(self);
+    self->tape_full = false;
+    self->pos_w = 0;
+    tape_change_end(self);
+    ++self->tape_epoch;
+    self->quiet_frames = 0;
+
+    self->cur_tempo = 0;
+    self->cur_mod_depth = 0;
+    update_delay_times(self, tempo);
+    self->cur_d_t_ch1 = self->tgt_d_t_ch1;
+    self->cur_d_t_ch2 = self->tgt_d_t_ch2;
+    self->ap_l = 0;
+    self->ap_r = 0;
+    for (int h = 0 ; h < TAP_HEADS ; ++h) {
+        self->heads[h].d = self->heads[h].tgt_d;
+        self->heads[h].ap_l = 0;
+        self->heads[h].ap_r = 0;
+    }
+}
+
+/**
+* Reads a number from an atom.
+* \param self pointer to current plugin instance
+* \param atom Int, Long, Float or Double atom
+* \return value of the atom, 0 for other types
+*/
+static double atom_number(BollieDelay* self, const LV2_Atom* atom) {
+    if (atom->type == self->uris.atom_Float)
+        return ((const LV2_Atom_Float*)atom)->body;
+    if (atom->type == self->uris.atom_Double)
+        return ((const LV2_Atom_Double*)atom)->body;
+    if (atom->type == self->uris.atom_Int)
+        return ((const LV2_Atom_Int*)atom)->body;
+    if (atom->type == self->uris.atom_Long)
+        return ((const LV2_Atom_Long*)atom)->body;
+    return 0;
+}
+
+/**
+* Handles a time:Position event from the host. Only the tempo matters for
+* the delay times, bar, beat and speed are ignored.
+* \param self pointer to current plugin instance
+* \param obj position object
+*/
+static void handle_position(BollieDelay* self, const LV2_Atom_Object* obj) {
+    const LV2_Atom* bpm = NULL;
+    lv2_atom_object_get(obj, self->uris.time_beatsPerMinute, &bpm, 0);
+    if (bpm) {
+        double tempo = atom_number(self, bpm);
+        if (tempo > 0) {
+            self->host_bpm = (float)tempo;
+            self->host_port = *self->tempo_host;
+        }
+    }
+}
+
+/**
+* Runs the read and mix passes of the tape kernel over a part of the block,
+* split into wrap-free segments.
+* \param self pointer to current plugin instance
+* \param kp kernel parameters, kept across parts
+* \param src_l samples to record, left side
+* \param src_r samples to record, right side
+* \param dry_l dry input samples, left side
+* \param dry_r dry input samples, right side
+* \param out_l output samples, left side
+* \param out_r output samples, right side
+* \param pos_w write position, advanced by n_samples
+* \param tape_full the tape has been filled completely, updated on wrap
+* \param n_samples number of frames
+*/
+static void process_tape(BollieDelay* self, KernelParams* kp, 
+    const float* src_l, const float* src_r,
+    const float* dry_l, const float* dry_r, float* out_l, float* out_r,
+    int* pos_w, bool* tape_full, uint32_t n_samples) {
+
+    const uint32_t mask = self->tape_len - 1;
+    uint32_t i = 0;
+    while (i < n_samples) {
+        /* A segment never crosses the end of the tape and is two samples
+        shorter than both delay times. So everything it reads, including
+        the neighbours for interpolation, has been written before and
+        reading and writing can be done in separate passes. */
+        uint32_t n = n_samples - i;
+        if (n > KERNEL_LEN)
+            n = KERNEL_LEN;
+        if (n > mask + 1 - (uint32_t)*pos_w)
+            n = mask + 1 - (uint32_t)*pos_w;
+        double d_min = kp->d_l;
+        if (kp->d_r < d_min) d_min = kp->d_r;
+        if (kp->tgt_d_l < d_min) d_min = kp->tgt_d_l;
+        if (kp->tgt_d_r < d_min) d_min = kp->tgt_d_r;
+        for (int h = 0 ; self->heads_active && h < TAP_HEADS ; ++h) {
+            const BollieHead* hd = &self->heads[h];
+            if (hd->gain_l == 0 && hd->gain_r == 0 &&
+                hd->tgt_gain_l == 0 && hd->tgt_gain_r == 0)
+                continue;
+            if (hd->d < d_min) d_min = hd->d;
+            if (hd->tgt_d < d_min) d_min = hd->tgt_d;
+        }
+        // The modulation takes at most half of the main delay times
+        if (kp->mod_depth != 0 || kp->tgt_mod_depth != 0)
+            d_min *= 0.5;
+        if (d_min < n + 2)
+            n = d_min > 3 ? (uint32_t)d_min - 2 : 1;
+
+        kernels[kernel_mode(kp)](self, kp, src_l + i, src_r + i, dry_l + i, 
+            dry_r + i, out_l + i, out_r + i, *pos_w, *tape_full, n);
+
+        // Iterate write position, it wraps to 0 at the tape end
+        i += n;
+        *pos_w = (int)(((uint32_t)*pos_w + n) & mask);
+        *tape_full |= *pos_w == 0;
+    }
+}
+
+/**
+* Processes a part of the current block with the wet path decimated. Input
+* goes down to the tape rate, through the filters and the tape kernel and
+* back up. The kernel only puts out the wet signal, it is blended with the
+* dry signal at the full rate. The feedback stays on the tape, so the group
+* delay of the resampler, about 7 samples at half and 21 at quarter rate, is
+* the same for every repeat. It is left in rather than taken off the delay
+* time, which would only put the first repeat in place.
+* \param self pointer to current plugin instance
+* \param kp kernel parameters, kept across parts
+* \param first first filter stage or NULL
+* \param second second filter stage or NULL
+* \param input_l input samples, left side
+* \param input_r input samples, right side
+* \param output_l output samples, left side
+* \param output_r output samples, right side
+* \param pos_w write position, advanced by the samples recorded
+* \param tape_full the tape has been filled completely, updated on wrap
+* \param n_samples number of frames in the part
+* \return number of samples recorded on the tape
+*/
+static uint32_t process_decimated(BollieDelay* self, KernelParams* kp,
+    BollieStereoFilter* first, BollieStereoFilter* second,
+    const float* input_l, const float* input_r,
+    float* output_l, float* output_r,
+    int* pos_w, bool* tape_full, uint32_t n_samples) {
+
+    float tape_l[BR_CHUNK];
+    float tape_r[BR_CHUNK];
+    float wet_l[BR_CHUNK];
+    float wet_r[BR_CHUNK];
+
+    // The kernel sees unity wet gain and no dry signal
+    float wet_gain = kp->wet_gain;
+    float dry_gain = kp->dry_gain;
+    const float tgt_wet_gain = kp->tgt_wet_gain;
+    const float tgt_dry_gain = kp->tgt_dry_gain;
+    kp->wet_gain = kp->tgt_wet_gain = 1;
+    kp->dry_gain = kp->tgt_dry_gain = 0;
+
+    uint32_t recorded = 0;
+    uint32_t i = 0;
+    while (i < n_samples) {
+        uint32_t m = n_samples - i;
+        if (m > BR_CHUNK)
+            m = BR_CHUNK;
+
+        const uint32_t n = br_down(&self->resampler, input_l + i,
+            input_r + i, m, tape_l, tape_r);
+        if (first)
+            bf_stereo_process(tape_l, tape_r, n, first, second);
+        process_tape(self, kp, tape_l, tape_r, tape_l, tape_r, tape_l, tape_r,
+            pos_w, tape_full, n);
+        br_up(&self->resampler, tape_l, tape_r, wet_l, wet_r);
+        recorded += n;
+
+        // Settled gains leave a plain blend
+        if (wet_gain == tgt_wet_gain && dry_gain == tgt_dry_gain) {
+            for (uint32_t j = 0 ; j < m ; ++j) {
+                output_l[i + j] = dry_gain * input_l[i + j]
+                    + wet_gain * wet_l[j];
+                output_r[i + j] = dry_gain * input_r[i + j]
+                    + wet_gain * wet_r[j];
+            }
+            i += m;
+            continue;
         }
- 
-        // Apply the high cut filter if enabled
-        if (*self->high_on) {
-            cur_fs_l = bf_hcf(
-                cur_fs_l, 
-                *self->high_f, 
-                *self->high_q, 
-                self->rate, 
-                &self->filter_high_l
-            );
-            cur_fs_r = bf_hcf(
-                cur_fs_r,
-                *self->high_f,
-                *self->high_q,
-                self->rate, 
-                &self->filter_high_r
-            );
+        for (uint32_t j = 0 ; j < m ; ++j) {
+            wet_gain += (tgt_wet_gain - wet_gain) * SMOOTH_GAIN;
+            dry_gain += (tgt_dry_gain - dry_gain) * SMOOTH_GAIN;
+            output_l[i + j] = dry_gain * input_l[i + j] + wet_gain * wet_l[j];
+            output_r[i + j] = dry_gain * input_r[i + j] + wet_gain * wet_r[j];
         }
+        i += m;
+    }
 
-	// delay time smoothing
-	cur_d_t_ch1 = tgt_d_t_ch1 * 0.001f + cur_d_t_ch1 * 0.999f;
-	cur_d_t_ch2 = tgt_d_t_ch2 * 0.001f + cur_d_t_ch2 * 0.999f;
+    settle_gain(&wet_gain, tgt_wet_gain);
+    settle_gain(&dry_gain, tgt_dry_gain);
+    kp->wet_gain = wet_gain;
+    kp->dry_gain = dry_gain;
+    kp->tgt_wet_gain = tgt_wet_gain;
+    kp->tgt_dry_gain = tgt_dry_gain;
+    return recorded;
+}
 
-        /* Feedback and Crossfeed filling the buffer */
+/**
+* Processes a part of the current block.
+* \param self pointer to current plugin instance
+* \param kp kernel parameters, kept across parts
+* \param first first filter stage or NULL
+* \param second second filter stage or NULL
+* \param offset first frame of the part within the block
+* \param n_samples number of frames in the part
+* \return number of samples recorded on the tape
+*/
+static uint32_t process(BollieDelay* self, KernelParams* kp,
+    BollieStereoFilter* first, BollieStereoFilter* second,
+    uint32_t offset, uint32_t n_samples) {
 
-        // parameter smoothing for feedback/crossfeed
-        cur_feedback = target_feedback * 0.01f + cur_feedback * 0.99f;
-        cur_crossf = target_crossf * 0.01f + cur_crossf * 0.99f;
+    // State stuff to get more from heap to stack
+    const float* const input_l = self->input_l + offset;
+    const float* const input_r = self->input_r + offset;
+    float* const output_l = self->output_l + offset;
+    float* const output_r = self->output_r + offset;
+    int pos_w = self->pos_w;
+    bool tape_full = self->tape_full;
+
+    if (self->decim > 1) {
+        const uint32_t recorded = process_decimated(self, kp, first, second,
+            input_l, input_r, output_l, output_r, &pos_w, &tape_full,
+            n_samples);
+        tape_change_begin(self);
+        self->pos_w = pos_w;
+        self->tape_full = tape_full;
+        tape_change_end(self);
+        return recorded;
+    }
+
+    uint32_t i = 0;
+    while (i < n_samples) {
+        // Filter pass, as much of the part as the scratch buffers can hold
+        uint32_t m = n_samples - i;
+        const float* src_l = input_l + i;
+        const float* src_r = input_r + i;
+        if (first) {
+            if (m > self->scratch_len)
+                m = self->scratch_len;
+            memcpy(self->scratch_l, src_l, m * sizeof(float));
+            memcpy(self->scratch_r, src_r, m * sizeof(float));
+            bf_stereo_process(self->scratch_l, self->scratch_r, m, 
+                first, second);
+            src_l = self->scratch_l;
+            src_r = self->scratch_r;
+        }
+        process_tape(self, kp, src_l, src_r, input_l + i, input_r + i,
+            output_l + i, output_r + i, &pos_w, &tape_full, m);
+        i += m;
+    }
+    tape_change_begin(self);
+    self->pos_w = pos_w;
+    self->tape_full = tape_full;
+    tape_change_end(self);
+    return n_samples;
+}
+
+/**
+* Outputs silence while the input stays silent. Host tempo changes are
+* still followed.
+* \param self pointer to current plugin instance
+* \param n_samples number of samples in this current input block.
+* \return false if the input returned and the block has to be processed
+*/
+static bool bypass(BollieDelay* self, uint32_t n_samples) {
+    if (fmaxf(peak_level(self->input_l, n_samples), 
+        peak_level(self->input_r, n_samples)) >= SILENCE_LEVEL) {
+        self->silent = false;
+        self->quiet_frames = 0;
+        return false;
+    }
 
-        // Left Channel
-        self->buffer_l[pos_w] = cur_fs_l       // current filtered sample
-            + old_s_r * cur_crossf              // crossfeed sample
-            + old_s_l * cur_feedback            // feedback sample
-        ;
+    if (self->control && self->map) {
+        LV2_ATOM_SEQUENCE_FOREACH(self->control, ev) {
+            const LV2_Atom_Object* obj = (const LV2_Atom_Object*)&ev->body;
+            if ((obj->atom.type == self->uris.atom_Object ||
+                obj->atom.type == self->uris.atom_Blank) &&
+                obj->body.otype == self->uris.time_Position)
+                handle_position(self, obj);
+        }
+    }
 
-        // Right channel (s. above)
-        self->buffer_r[pos_w] = cur_fs_r
-            + old_s_l * cur_crossf
-            + old_s_r * cur_feedback
-        ;
+    memset(self->output_l, 0, n_samples * sizeof(float));
+    memset(self->output_r, 0, n_samples * sizeof(float));
+    self->restored = false;
+    self->trails = self->trails_port && *self->trails_port > 0;
+    self->frames += n_samples;
+    return true;
+}
 
-        /* end of buffer handling */
+/**
+* Processes one block of samples.
+* \param self pointer to current plugin instance
+* \param n_samples number of samples in this current input block.
+*/
+static void run_block(BollieDelay* self, uint32_t n_samples) {
+    // First some TAP handling, a tap is the rising edge on the port
+    const float tap = *self->tap;
+    if (tap > 0 && self->last_tap <= 0) {
+        float d = handle_tap(self, self->frames);
+        if (d > 0) 
+            self->tempo_tap = (float)d;
+    }
+    self->last_tap = tap;
 
-        // Paraemter smoothing for wet and dry gain
-        wet_gain = target_wet_gain * 0.01f + wet_gain * 0.99f;
-        dry_gain = target_dry_gain * 0.01f + dry_gain * 0.99f;
+    // Nothing to do while input and tape are silent
+    if (self->silent && bypass(self, n_samples)) {
+        publish_state(self);
+        return;
+    }
 
-        // Will it blend? ;)
-        self->output_l[i] = 
-            dry_gain * self->input_l[i] + wet_gain * old_s_l;
-        self->output_r[i] = 
-            dry_gain * self->input_r[i] + wet_gain * old_s_r;
+    // A new wet path rate starts over with an empty tape
+    const unsigned int decim = current_decimation(self);
+    if (decim != self->decim)
+        set_decimation(self, decim, current_tempo(self));
+
+    const unsigned long fpu = denormals_disable();
+    const uint32_t pos_start = (uint32_t)self->pos_w;
+
+    // Handle tempo mode
+    update_delay_times(self, current_tempo(self));
+
+    // Let's do the vfade gain calculation
+    const float cp_blend = *self->mix;
+    float target_dry_gain = 1;
+    float target_wet_gain = 0;
+    if (cp_blend > 0 && cp_blend < 50) {
+        target_wet_gain = powf(10.0f, (cp_blend-50) * 0.04f);
+    }
+    else if (cp_blend < 100 && cp_blend > 50) {
+        target_wet_gain = 1;
+        target_dry_gain = powf(10.0f, (cp_blend-50) * -0.04f);
+    }
+    else if (cp_blend == 50) {
+        target_wet_gain = 1;
+    }
+    else if (cp_blend == 100) {
+        target_wet_gain = 1;
+        target_dry_gain = 0;
+    }
+
+    // Lets do the feedback/crossfeed calculation        
+    const float cp_feedback = *self->feedback;
+    float target_feedback = 0;
+    if (cp_feedback > 0 && cp_feedback < 100) {
+        target_feedback = powf(10.0f, (cp_feedback-100) * 0.02f);
+    }
+    else if (cp_feedback == 100) {
+        target_feedback = 1;
+    }
+
+    const float cp_crossf = *self->crossf;
+    float target_crossf = 0;
+    if (cp_crossf > 0 && cp_crossf < 100) {
+        target_crossf = powf(10.0f, (cp_crossf-100) * 0.02f);
+    }
+    else if (cp_feedback == 100) {
+        target_crossf = 1;
+    }
+
+    // Gains of the additional heads, panned with a balance law
+    self->heads_active = false;
+    for (int h = 0 ; h < TAP_HEADS ; ++h) {
+        BollieHead* hd = &self->heads[h];
+        const float cp_gain = hd->gain ? *hd->gain : 0;
+        float pan = hd->pan ? *hd->pan * 0.01f : 0;
+        pan = pan < -1 ? -1 : pan > 1 ? 1 : pan;  // hosts may exceed the range
+        float gain = 0;
+        if (cp_gain > 0 && cp_gain < 100) {
+            gain = powf(10.0f, (cp_gain-100) * 0.02f);
+        }
+        else if (cp_gain >= 100) {
+            gain = 1;
+        }
+        hd->tgt_gain_l = pan > 0 ? gain * (1 - pan) : gain;
+        hd->tgt_gain_r = pan < 0 ? gain * (1 + pan) : gain;
+        if (hd->gain_l == 0 && hd->gain_r == 0)
+            hd->d = hd->tgt_d;  // a silent head jumps to its delay time
+        if (hd->tgt_gain_l != 0 || hd->tgt_gain_r != 0 ||
+            hd->gain_l != 0 || hd->gain_r != 0)
+            self->heads_active = true;
+    }
+
+    /* Take a snapshot of the filter ports and set up the filters once for
+    the whole block. The host doesn't change ports during run(). */
+    BollieStereoFilter* first = NULL;
+    BollieStereoFilter* second = NULL;
+    if (*self->low_on) {
+        bf_stereo_set_lcf(*self->low_f, *self->low_q, self->tape_rate,
+            &self->filter_low);
+        first = &self->filter_low;
+    }
+    if (*self->high_on) {
+        bf_stereo_set_hcf(*self->high_f, *self->high_q, self->tape_rate,
+            &self->filter_high);
+        if (first)
+            second = &self->filter_high;
+        else
+            first = &self->filter_high;
+    }
 
-        // Iterate write position, reset to 0 if required
-        pos_w = pos_w + 1 >= MAX_TAPE_LEN ? 0 : pos_w + 1;
+    KernelParams kp = {
+        .d_l = self->cur_d_t_ch1,
+        .d_r = self->cur_d_t_ch2,
+        .tgt_d_l = self->tgt_d_t_ch1,
+        .tgt_d_r = self->tgt_d_t_ch2,
+        .feedback = self->cur_feedback,
+        .crossf = self->cur_crossf,
+        .wet_gain = self->wet_gain,
+        .dry_gain = self->dry_gain,
+        .tgt_feedback = target_feedback,
+        .tgt_crossf = target_crossf,
+        .tgt_wet_gain = target_wet_gain,
+        .tgt_dry_gain = target_dry_gain,
+        .interp = (Interp)self->cur_interp,
+        .ap_l = self->ap_l,
+        .ap_r = self->ap_r,
+    };
+
+    /* The LFO runs at the tape rate. Its phase increment wraps a cycle
+    like the fraction of a read position wraps a sample. */
+    const ModShape shape = current_mod_shape(self);
+    const double mod_rate = self->mod_rate && *self->mod_rate > 0 ?
+        *self->mod_rate : 0;
+    kp.mod_depth = self->cur_mod_depth;
+    kp.tgt_mod_depth = mod_depth_target(self);
+    kp.mod_wave = self->mod_wave[shape];
+    kp.mod_phase = self->mod_phase;
+    kp.mod_inc = (uint32_t)(mod_rate / self->tape_rate * PHASE_ONE);
+    kp.mod_spread = shape == MOD_CHORUS ? 1u << 30 : 0;
+
+    /* Host tempo changes are applied at the frame they happen at, so the
+    block is processed in parts between the position events. */
+    uint32_t offset = 0;
+    uint32_t recorded = 0;
+    if (self->control && self->map) {
+        LV2_ATOM_SEQUENCE_FOREACH(self->control, ev) {
+            const LV2_Atom_Object* obj = (const LV2_Atom_Object*)&ev->body;
+            if ((obj->atom.type != self->uris.atom_Object &&
+                obj->atom.type != self->uris.atom_Blank) ||
+                obj->body.otype != self->uris.time_Position)
+                continue;
+
+            uint32_t frame = ev->time.frames < 0 ? 0 : 
+                (uint32_t)ev->time.frames;
+            if (frame > n_samples)
+                frame = n_samples;
+            if (frame > offset) {
+                recorded += process(self, &kp, first, second, offset, 
+                    frame - offset);
+                offset = frame;
+            }
+
+            handle_position(self, obj);
+            update_delay_times(self, current_tempo(self));
+            kp.tgt_d_l = self->tgt_d_t_ch1;
+            kp.tgt_d_r = self->tgt_d_t_ch2;
+        }
     }
+    recorded += process(self, &kp, first, second, offset, n_samples - offset);
+    self->tape_written += recorded;
+
+    // Tapes are allocated and released by the worker
+    if (self->schedule)
+        request_tape(self, current_tempo(self));
+
+    detect_silence(self, pos_start, recorded, n_samples);
+    denormals_restore(fpu);
+
     // Memorize state for next run
-    self->cur_d_t_ch1 = cur_d_t_ch1;
-    self->cur_d_t_ch2 = cur_d_t_ch2;
-    self->pos_w = pos_w;
-    self->wet_gain = wet_gain;
-    self->dry_gain = dry_gain;
-    self->cur_crossf = cur_crossf;
-    self->cur_feedback = cur_feedback;
+    self->restored = false;
+    self->trails = self->trails_port && *self->trails_port > 0;
+    self->frames += n_samples;
+    self->cur_d_t_ch1 = kp.d_l;
+    self->cur_d_t_ch2 = kp.d_r;
+    self->wet_gain = kp.wet_gain;
+    self->dry_gain = kp.dry_gain;
+    self->cur_crossf = kp.crossf;
+    self->cur_feedback = kp.feedback;
+    self->ap_l = kp.ap_l;
+    self->ap_r = kp.ap_r;
+    self->cur_mod_depth = kp.mod_depth;
+    self->mod_phase = kp.mod_phase;
+    publish_state(self);
+}
+
+/**
+* Returns a monotonic time stamp in nanoseconds.
+*/
+static double load_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+* Accounts the time spent in one run() and publishes average and peak load
+* once per LOAD_WINDOW. The load is the share of the block's real time.
+* \param self pointer to current plugin instance
+* \param ns time spent in run() in nanoseconds
+* \param n_samples number of samples in this current input block.
+*/
+static void update_load(BollieDelay* self, double ns, uint32_t n_samples) {
+    if (n_samples == 0)
+        return;
+
+    const float load = ns * self->rate / (n_samples * 1e7);
+    if (load > self->load_max)
+        self->load_max = load;
+    self->load_time += ns;
+    self->load_frames += n_samples;
+
+    if (self->load_frames >= LOAD_WINDOW * self->rate) {
+        if (self->load_avg)
+            *self->load_avg = self->load_time * self->rate 
+                / (self->load_frames * 1e7);
+        if (self->load_peak)
+            *self->load_peak = self->load_max;
+        self->load_time = 0;
+        self->load_frames = 0;
+        self->load_max = 0;
+    }
+}
+
+/**
+* Main process function of the plugin.
+* \param instance  handle of the current plugin
+* \param n_samples number of samples in this current input block.
+*/
+static void run(LV2_Handle instance, uint32_t n_samples) {
+    BollieDelay* self = (BollieDelay*)instance;
+
+    // The clock is only read if the host shows the load
+    if (!self->load_avg && !self->load_peak) {
+        run_block(self, n_samples);
+        return;
+    }
+    const double start = load_clock();
+    run_block(self, n_samples);
+    update_load(self, load_clock() - start, n_samples);
 }
 
 
@@ -538,7 +2926,414 @@ static void deactivate(LV2_Handle instance) {
 * Cleanup, freeing memory and stuff
 */
 static void cleanup(LV2_Handle instance) {
-    free(instance);
+    BollieDelay* self = (BollieDelay*)instance;
+    free(self->scratch_l);
+    for (uint32_t i = 0 ; i < self->n_stale ; ++i)
+        bt_free(self->stale[i]);
+    bt_free(self->buffer_l);
+    free(self);
+}
+
+
+/**
+* Frees a path handed out by the host.
+*/
+static void free_path(const LV2_Feature* const* features, char* path) {
+    LV2_State_Free_Path* fp = 
+        (LV2_State_Free_Path*)find_feature(features, LV2_STATE__freePath);
+    if (fp)
+        fp->free_path(fp->handle, path);
+    else
+        free(path);
+}
+
+
+/**
+* Stores a float state property.
+*/
+static void store_float(BollieDelay* self, LV2_State_Store_Function store,
+    LV2_State_Handle handle, LV2_URID key, float value) {
+    store(handle, key, &value, sizeof(float), self->uris.atom_Float, 
+        LV2_STATE_IS_POD | LV2_STATE_IS_PORTABLE);
+}
+
+
+/**
+* Stores a double state property.
+*/
+static void store_double(BollieDelay* self, LV2_State_Store_Function store,
+    LV2_State_Handle handle, LV2_URID key, double value) {
+    store(handle, key, &value, sizeof(double), self->uris.atom_Double, 
+        LV2_STATE_IS_POD | LV2_STATE_IS_PORTABLE);
+}
+
+
+/**
+* Retrieves a number state property.
+* \return true if the property exists and is a number
+*/
+static bool retrieve_number(BollieDelay* self, 
+    LV2_State_Retrieve_Function retrieve, LV2_State_Handle handle, 
+    LV2_URID key, double* value) {
+
+    size_t size;
+    uint32_t type;
+    uint32_t flags;
+    const void* data = retrieve(handle, key, &size, &type, &flags);
+    if (data && type == self->uris.atom_Float && size == sizeof(float))
+        *value = *(const float*)data;
+    else if (data && type == self->uris.atom_Double && size == sizeof(double))
+        *value = *(const double*)data;
+    else
+        return false;
+    return true;
+}
+
+
+/**
+* Stores a 32 bit value as little-endian bytes.
+* \param b four bytes
+* \param v value
+*/
+static inline void put_le32(unsigned char* b, uint32_t v) {
+    b[0] = v;
+    b[1] = v >> 8;
+    b[2] = v >> 16;
+    b[3] = v >> 24;
+}
+
+/**
+* Loads a 32 bit value from little-endian bytes.
+* \param b four bytes
+* \return value
+*/
+static inline uint32_t get_le32(const unsigned char* b) {
+    return b[0] | (uint32_t)b[1] << 8 | (uint32_t)b[2] << 16 |
+        (uint32_t)b[3] << 24;
+}
+
+/**
+* Writes tape samples to a file as little-endian IEEE 754 floats, whatever
+* the tape format and the byte order of the host are.
+* \param f file to write to
+* \param buf tape samples
+* \param n number of samples
+* \return true on success
+*/
+static bool write_samples(FILE* f, const tape_t* buf, uint32_t n) {
+    unsigned char chunk[4 * 256];
+    while (n > 0) {
+        uint32_t m = n < 256 ? n : 256;
+        for (uint32_t i = 0 ; i < m ; ++i) {
+            const float x = tape_load(buf[TAPE_STRIDE * i]);
+            uint32_t v;
+            memcpy(&v, &x, sizeof(v));
+            put_le32(chunk + 4 * i, v);
+        }
+        if (fwrite(chunk, 4, m, f) != m)
+            return false;
+        buf += TAPE_STRIDE * m;
+        n -= m;
+    }
+    return true;
+}
+
+
+/**
+* Reads samples written by write_samples() from a file into the tape.
+* \param f file to read from
+* \param buf tape samples
+* \param n number of samples
+* \return true on success
+*/
+static bool read_samples(FILE* f, tape_t* buf, uint32_t n) {
+    unsigned char chunk[4 * 256];
+    while (n > 0) {
+        uint32_t m = n < 256 ? n : 256;
+        if (fread(chunk, 4, m, f) != m)
+            return false;
+        for (uint32_t i = 0 ; i < m ; ++i) {
+            const uint32_t v = get_le32(chunk + 4 * i);
+            float x;
+            memcpy(&x, &v, sizeof(x));
+            buf[TAPE_STRIDE * i] = tape_store(x);
+        }
+        buf += TAPE_STRIDE * m;
+        n -= m;
+    }
+    return true;
+}
+
+
+/**
+* Snapshot of the tape and the state for save()
+*/
+typedef struct {
+    const tape_t* buf_l;    ///< tape, left side
+    const tape_t* buf_r;    ///< tape, right side
+    uint32_t len;           ///< length of each channel
+    uint32_t pos;           ///< write position
+    bool full;              ///< the write position wrapped
+    SavedState state;       ///< published by run()
+} SaveSnapshot;
+
+/**
+* Takes a snapshot of the tape and the state published by run(), between
+* two changes. The caller has to count itself in tape_readers first, so
+* the tape isn't released while it is read.
+* \param self pointer to current plugin instance
+* \param s receives the snapshot
+*/
+static void take_snapshot(BollieDelay* self, SaveSnapshot* s) {
+    uint32_t seq;
+    do {
+        seq = __atomic_load_n(&self->tape_seq, __ATOMIC_ACQUIRE);
+        s->buf_l = self->buffer_l;
+        s->buf_r = self->buffer_r;
+        s->len = self->tape_len;
+        s->pos = (uint32_t)self->pos_w;
+        s->full = self->tape_full;
+        s->state = self->saved;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) ||
+        seq != __atomic_load_n(&self->tape_seq, __ATOMIC_RELAXED));
+}
+
+/**
+* Writes the active region of the tape to a file. That is the part a read
+* head can reach with the current delay times, the oldest sample first.
+* The file holds the number of samples per channel, then the left and the
+* right samples, all as 32 bit little-endian values.
+*
+* save() runs concurrently with run(). run() keeps recording, that only
+* touches samples older than the region unless the region spans about the
+* whole tape.
+* \param s snapshot of the tape
+* \param path absolute path of the file
+* \return true on success
+*/
+static bool save_tape(const SaveSnapshot* s, const char* path) {
+    uint32_t n = (uint32_t)s->state.longest + 2;
+    uint32_t recorded = s->full ? s->len - 1 : s->pos;
+    if (n > recorded)
+        n = recorded;
+
+    FILE* f = fopen(path, "wb");
+    if (!f)
+        return false;
+
+    // The region may wrap around the tape end
+    uint32_t start = (s->pos - n) & (s->len - 1);
+    uint32_t first = n < s->len - start ? n : s->len - start;
+    unsigned char header[4];
+    put_le32(header, n);
+    bool ok = fwrite(header, sizeof(header), 1, f) == 1;
+    ok = ok && write_samples(f, s->buf_l + TAPE_STRIDE * start, first);
+    ok = ok && write_samples(f, s->buf_l, n - first);
+    ok = ok && write_samples(f, s->buf_r + TAPE_STRIDE * start, first);
+    ok = ok && write_samples(f, s->buf_r, n - first);
+    return !fclose(f) && ok;
+}
+
+
+/**
+* Reads a tape region written by save_tape(). The region is placed at the
+* start of the tape, recording continues right after it.
+* \param self pointer to current plugin instance
+* \param path absolute path of the file
+* \return true on success
+*/
+static bool restore_tape(BollieDelay* self, const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (!f)
+        return false;
+
+    unsigned char header[4];
+    bool ok = fread(header, sizeof(header), 1, f) == 1;
+    const uint32_t n = ok ? get_le32(header) : 0;
+    if (ok && n + 1 > self->tape_len)
+        grow_tape(self, n + 1);
+    ok = ok && n < self->tape_len;
+    ok = ok && read_samples(f, self->buffer_l, n);
+    ok = ok && read_samples(f, self->buffer_r, n);
+    fclose(f);
+
+    self->pos_w = ok ? n : 0;
+    self->tape_full = false;
+    ++self->tape_epoch;
+    return ok;
+}
+
+
+/**
+* Saves tempo and smoothing state, so a recalled snapshot continues where
+* it was. If the host can hand out files, the active region of the tape is
+* saved as well.
+*/
+static LV2_State_Status save(LV2_Handle instance, 
+    LV2_State_Store_Function store, LV2_State_Handle handle, 
+    uint32_t flags, const LV2_Feature* const* features) {
+
+    BollieDelay* self = (BollieDelay*)instance;
+    if (!self->map)
+        return LV2_STATE_ERR_NO_FEATURE;
+
+    // The tape isn't released while it is read
+    __atomic_add_fetch(&self->tape_readers, 1, __ATOMIC_SEQ_CST);
+    SaveSnapshot s;
+    take_snapshot(self, &s);
+
+    const SavedState* st = &s.state;
+    store_float(self, store, handle, self->uris.bdl_tempoTap, st->tempo_tap);
+    store_double(self, store, handle, self->uris.bdl_delayL, st->delay_l);
+    store_double(self, store, handle, self->uris.bdl_delayR, st->delay_r);
+    store_float(self, store, handle, self->uris.bdl_feedback, st->feedback);
+    store_float(self, store, handle, self->uris.bdl_crossfeed, st->crossf);
+    store_float(self, store, handle, self->uris.bdl_wetGain, st->wet_gain);
+    store_float(self, store, handle, self->uris.bdl_dryGain, st->dry_gain);
+    store_float(self, store, handle, self->uris.bdl_decimation, st->decim);
+
+    LV2_State_Make_Path* make_path = 
+        (LV2_State_Make_Path*)find_feature(features, LV2_STATE__makePath);
+    LV2_State_Map_Path* map_path = 
+        (LV2_State_Map_Path*)find_feature(features, LV2_STATE__mapPath);
+    char* path = make_path && map_path ? 
+        make_path->path(make_path->handle, "tape.raw") : NULL;
+    if (path && save_tape(&s, path)) {
+        char* apath = map_path->abstract_path(map_path->handle, path);
+        if (apath) {
+            store(handle, self->uris.bdl_tape, apath, strlen(apath) + 1,
+                self->uris.atom_Path, LV2_STATE_IS_POD | LV2_STATE_IS_PORTABLE);
+            free_path(features, apath);
+        }
+    }
+    if (path)
+        free_path(features, path);
+    __atomic_sub_fetch(&self->tape_readers, 1, __ATOMIC_SEQ_CST);
+    return LV2_STATE_SUCCESS;
+}
+
+
+/**
+* Restores what save() stored. Missing properties keep their current value.
+* It resizes and writes the tape, so state:threadSafeRestore isn't declared
+* and the host never calls it concurrently with run().
+*/
+static LV2_State_Status restore(LV2_Handle instance, 
+    LV2_State_Retrieve_Function retrieve, LV2_State_Handle handle, 
+    uint32_t flags, const LV2_Feature* const* features) {
+
+    BollieDelay* self = (BollieDelay*)instance;
+    if (!self->map)
+        return LV2_STATE_ERR_NO_FEATURE;
+
+    double v;
+    double d_l = self->cur_d_t_ch1;
+    double d_r = self->cur_d_t_ch2;
+
+    // Delay times and tape are in samples of the rate they were saved at
+    if (retrieve_number(self, retrieve, handle, self->uris.bdl_decimation,
+        &v) && (v == 1 || v == 2 || v == 4) && v != self->decim) {
+        self->decim = v;
+        self->tape_rate = self->rate / self->decim;
+        self->cur_tempo = 0;
+        self->cur_mod_depth = 0;
+        br_init(&self->resampler, self->decim);
+    }
+    if (retrieve_number(self, retrieve, handle, self->uris.bdl_tempoTap, &v) &&
+        v > 0)
+        self->tempo_tap = v;
+    if (retrieve_number(self, retrieve, handle, self->uris.bdl_delayL, &v))
+        d_l = v < 0 ? 0 : v;
+    if (retrieve_number(self, retrieve, handle, self->uris.bdl_delayR, &v))
+        d_r = v < 0 ? 0 : v;
+
+    // Not concurrent with run(), so the tape can grow right away
+    double d = d_l > d_r ? d_l : d_r;
+    if (d + 1 > self->tape_len)
+        grow_tape(self, (uint32_t)ceil(d) + 2);
+    const double max_d = self->tape_len - 1;
+    self->cur_d_t_ch1 = d_l > max_d ? max_d : d_l;
+    self->cur_d_t_ch2 = d_r > max_d ? max_d : d_r;
+    if (retrieve_number(self, retrieve, handle, self->uris.bdl_feedback, &v))
+        self->cur_feedback = v;
+    if (retrieve_number(self, retrieve, handle, self->uris.bdl_crossfeed, &v))
+        self->cur_crossf = v;
+    if (retrieve_number(self, retrieve, handle, self->uris.bdl_wetGain, &v))
+        self->wet_gain = v;
+    if (retrieve_number(self, retrieve, handle, self->uris.bdl_dryGain, &v))
+        self->dry_gain = v;
+
+    LV2_State_Map_Path* map_path = 
+        (LV2_State_Map_Path*)find_feature(features, LV2_STATE__mapPath);
+    size_t size;
+    uint32_t type;
+    uint32_t vflags;
+    const char* apath = (const char*)retrieve(handle, self->uris.bdl_tape, 
+        &size, &type, &vflags);
+    if (map_path && apath && type == self->uris.atom_Path) {
+        char* path = map_path->absolute_path(map_path->handle, apath);
+        if (path) {
+            restore_tape(self, path);
+            free_path(features, path);
+        }
+    }
+
+    self->restored = true;
+    publish_state(self);
+    return LV2_STATE_SUCCESS;
+}
+
+
+/**
+* Worker: allocates and releases tapes outside the audio thread.
+*/
+static LV2_Worker_Status work(LV2_Handle instance, 
+    LV2_Worker_Respond_Function respond, LV2_Worker_Respond_Handle handle,
+    uint32_t size, const void* data) {
+
+    if (size != sizeof(TapeWork))
+        return LV2_WORKER_ERR_UNKNOWN;
+
+    TapeWork w = *(const TapeWork*)data;
+    if (!w.len) {
+        bt_free(w.tape);
+        return LV2_WORKER_SUCCESS;
+    }
+
+    size_t alloc = 0;
+    w.tape = (tape_t*)bt_alloc(tape_size(w.len), &alloc);
+    w.len = w.tape ? tape_fit(alloc) : 0;
+    /* run() goes on recording, over the oldest part of the snapshot if the
+    old tape is full. The response clears what this may have caught. */
+    if (w.tape)
+        copy_tape(w.tape, w.len, 0, w.from, w.from_len, w.pos - w.n, w.n);
+    return respond(handle, sizeof(w), &w);
+}
+
+
+/**
+* Takes over a tape allocated and filled by the worker. This runs in the
+* audio thread and only copies what was recorded since the request.
+*/
+static LV2_Worker_Status work_response(LV2_Handle instance, uint32_t size,
+    const void* body) {
+
+    BollieDelay* self = (BollieDelay*)instance;
+    if (size != sizeof(TapeWork))
+        return LV2_WORKER_ERR_UNKNOWN;
+
+    const TapeWork* w = (const TapeWork*)body;
+    self->resize_pending = false;
+    if (!w->tape)
+        return LV2_WORKER_SUCCESS;
+
+    // Recording might have started over or the tape grown meanwhile
+    if (w->epoch != self->tape_epoch || w->len <= self->tape_len)
+        release_tape(self, w->tape);
+    else
+        release_tape(self, take_tape(self, w));
+    return LV2_WORKER_SUCCESS;
 }
 
 
@@ -546,6 +3341,12 @@ static void cleanup(LV2_Handle instance) {
 * extension stuff for additional interfaces
 */
 static const void* extension_data(const char* uri) {
+    static const LV2_State_Interface state = { save, restore };
+    static const LV2_Worker_Interface worker = { work, work_response, NULL };
+    if (!strcmp(uri, LV2_STATE__interface))
+        return &state;
+    if (!strcmp(uri, LV2_WORKER__interface))
+        return &worker;
     return NULL;
 }
 
@@ -554,7 +3355,7 @@ static const void* extension_data(const char* uri) {
 * Descriptor linking our methods.
 */
 static const LV2_Descriptor descriptor = {
-    URI,
+    BDL_URI,
     instantiate,
     connect_port,
     activate,
@@ -27,6 +27,110 @@
 #include "bolliefilter.h"
 #include <math.h>
 
+/**
+* Approximates sine and cosine of half the angular frequency with short
+* polynomials, which is accurate to about 1e-6 and a lot cheaper than
+* the libm calls.
+* \param w0     Angular frequency, 0 to 2 PI
+* \param s      Receives sin(w0 / 2)
+* \param c      Receives cos(w0 / 2)
+*/
+static void half_sincos(const float w0, float* s, float* c) {
+    float x = 0.5f * w0;
+    float sign = 1;
+    if (x > 0.5f * PI) {
+        // Mirror into the first quadrant, where the series converge fast
+        x = PI - x;
+        sign = -1;
+    }
+    if (x < 0)
+        x = 0;
+
+    // Taylor series up to x^11 and x^12 in Horner form
+    const float x2 = x * x;
+    *s = x * (1 + x2 * (-1.f/6 + x2 * (1.f/120 + x2 * (-1.f/5040 
+        + x2 * (1.f/362880 + x2 * (-1.f/39916800))))));
+    *c = sign * (1 + x2 * (-1.f/2 + x2 * (1.f/24 + x2 * (-1.f/720 
+        + x2 * (1.f/40320 + x2 * (-1.f/3628800 
+        + x2 * (1.f/479001600)))))));
+}
+
+
+/**
+* Keeps a cut off frequency clear of the Nyquist frequency. A decimated wet
+* path runs at a quarter of the rate, where the cut off frequencies of the
+* controls would fold back or make the filter unstable.
+* \param freq   Filter cut off frequency
+* \param rate   Current sampling rate
+* \return       Cut off frequency the coefficients are calculated for
+*/
+static float max_freq(const float freq, double rate) {
+    const float top = BF_MAX_FREQ * rate;
+    return freq < top ? freq : top;
+}
+
+
+/**
+* Calculates normalized low cut filter coefficients.
+* \param freq   Filter cut off frequency
+* \param Q      Filter quality
+* \param rate   Current sampling rate
+* \param c      Coefficients in the order b0, b1, b2, a1, a2
+*/
+static void calc_lcf(const float freq, const float Q, double rate, 
+    float* c) {
+
+    /* With s and k the sine and cosine of w0 / 2: sin(w0) = 2 s k, 
+    1 + cos(w0) = 2 k^2 and cos(w0) = k^2 - s^2 */
+    float s, k;
+    half_sincos(2 * PI * max_freq(freq, rate) / rate, &s, &k);
+    float alpha = s * k / Q;
+    float a0 = 1+alpha;
+    float a1 = -2 * (k*k - s*s);
+    float a2 = 1-alpha;
+    float b0 = k*k;
+    float b1 = -2 * k*k;
+    float b2 = k*k;
+
+    // Normalize once, so processing only needs multiply-adds
+    c[0] = b0 / a0;
+    c[1] = b1 / a0;
+    c[2] = b2 / a0;
+    c[3] = a1 / a0;
+    c[4] = a2 / a0;
+}
+
+
+/**
+* Calculates normalized high cut filter coefficients.
+* \param freq   Filter cut off frequency
+* \param Q      Filter quality
+* \param rate   Current sampling rate
+* \param c      Coefficients in the order b0, b1, b2, a1, a2
+*/
+static void calc_hcf(const float freq, const float Q, double rate, 
+    float* c) {
+
+    // Same as calc_lcf(), with 1 - cos(w0) = 2 s^2
+    float s, k;
+    half_sincos(2 * PI * max_freq(freq, rate) / rate, &s, &k);
+    float alpha = s * k / Q;
+    float a0 = 1+alpha;
+    float a1 = -2 * (k*k - s*s);
+    float a2 = 1-alpha;
+    float b0 = s*s;
+    float b1 = 2 * s*s;
+    float b2 = s*s;
+
+    // Normalize once, so processing only needs multiply-adds
+    c[0] = b0 / a0;
+    c[1] = b1 / a0;
+    c[2] = b2 / a0;
+    c[3] = a1 / a0;
+    c[4] = a2 / a0;
+}
+
+
 /**
 * Initializes a BollieFilter object.
 * \param bf Pointer to a BollieFilter object.
@@ -51,104 +155,398 @@ void bf_reset(BollieFilter* bf) {
 
 
 /**
-* Processes a frame using a low cut filter.
-* \param in     Input sample
+* Sets up a BollieFilter object as low cut filter.
+* The coefficients are only recalculated if a parameter changed.
 * \param freq   Filter cut off frequency
 * \param Q      Filter quality
 * \param rate   Current sampling rate
 * \param bf     Pointer to the BollieFilter object
-* \return       Output sample
-* \todo         Validating parameters
 */
-float bf_lcf(const float in, const float freq, const float Q, 
-    double rate, BollieFilter* bf) {
+void bf_set_lcf(const float freq, const float Q, double rate, 
+    BollieFilter* bf) {
 
-    // Precalculate if needed.
     if (freq != bf->freq || Q != bf->Q || rate != bf->rate) {
+        float c[5];
+        calc_lcf(freq, Q, rate, c);
         bf->freq = freq;
         bf->Q = Q;
         bf->rate = rate;
-        float w0 = 2 * PI * bf->freq / bf->rate;
-        float alpha = sin(w0) / (2*bf->Q);
-        bf->a0 = 1+alpha;
-        bf->a1 = -2 * cos(w0);
-        bf->a2 = 1-alpha;
-        bf->b0 = (1 + cos(w0)) / 2;
-        bf->b1 = -(1 + cos(w0));
-        bf->b2 = (1 + cos(w0)) / 2; 
+        bf->b0 = c[0];
+        bf->b1 = c[1];
+        bf->b2 = c[2];
+        bf->a1 = c[3];
+        bf->a2 = c[4];
     }
+}
 
-    // Filter roll
-    bf->in_buf[2] = bf->in_buf[1];
-    bf->in_buf[1] = bf->in_buf[0];
-    bf->in_buf[0] = in;
 
-    bf->processed_buf[2] = bf->processed_buf[1];
-    bf->processed_buf[1] = bf->processed_buf[0];
+/**
+* Sets up a BollieFilter object as high cut filter.
+* The coefficients are only recalculated if a parameter changed.
+* \param freq   Filter cut off frequency
+* \param Q      Filter quality
+* \param rate   Current sampling rate
+* \param bf     Pointer to the BollieFilter object
+*/
+void bf_set_hcf(const float freq, const float Q, double rate, 
+    BollieFilter* bf) {
+
+    if (freq != bf->freq || Q != bf->Q || rate != bf->rate) {
+        float c[5];
+        calc_hcf(freq, Q, rate, c);
+        bf->freq = freq;
+        bf->Q = Q;
+        bf->rate = rate;
+        bf->b0 = c[0];
+        bf->b1 = c[1];
+        bf->b2 = c[2];
+        bf->a1 = c[3];
+        bf->a2 = c[4];
+    }
+}
+
+
+/**
+* Processes a block of samples in place using the current coefficients.
+* \param buf    Samples to filter
+* \param n      Number of samples
+* \param bf     Pointer to the BollieFilter object
+*/
+void bf_process(float* buf, unsigned int n, BollieFilter* bf) {
+    unsigned int i = 0;
 
     // See if we need to fill the buffers first
-    if (bf->fill_count < 3) {
-        bf->processed_buf[0] = in;
+    for (; i < n && bf->fill_count < 3 ; ++i) {
+        bf->in_buf[2] = bf->in_buf[1];
+        bf->in_buf[1] = bf->in_buf[0];
+        bf->in_buf[0] = buf[i];
+
+        bf->processed_buf[2] = bf->processed_buf[1];
+        bf->processed_buf[1] = bf->processed_buf[0];
+        bf->processed_buf[0] = buf[i];
         bf->fill_count++;
-        return 0;
+        buf[i] = 0;
     }
 
-    return bf->processed_buf[0] =             
-            (bf->b0 / bf->a0 * bf->in_buf[0]) +
-            (bf->b1 / bf->a0 * bf->in_buf[1]) +
-            (bf->b2 / bf->a0 * bf->in_buf[2]) -
-            (bf->a1 / bf->a0 * bf->processed_buf[1]) -
-            (bf->a2 / bf->a0 * bf->processed_buf[2]);
+    const float b0 = bf->b0;
+    const float b1 = bf->b1;
+    const float b2 = bf->b2;
+    const float a1 = bf->a1;
+    const float a2 = bf->a2;
+    float x1 = bf->in_buf[0];
+    float x2 = bf->in_buf[1];
+    float y1 = bf->processed_buf[0];
+    float y2 = bf->processed_buf[1];
+
+    // Filter roll
+    for (; i < n ; ++i) {
+        const float x0 = buf[i];
+        const float y0 = b0 * x0 + b1 * x1 + b2 * x2 - a1 * y1 - a2 * y2;
+        x2 = x1;
+        x1 = x0;
+        y2 = y1;
+        y1 = y0;
+        buf[i] = y0;
+    }
+
+    bf->in_buf[0] = x1;
+    bf->in_buf[1] = x2;
+    bf->processed_buf[0] = y1;
+    bf->processed_buf[1] = y2;
 }
 
 
 /**
-* Processes a frame using a high cut filter.
-* \param in     Input sample
+* Initializes a BollieStereoFilter object.
+* \param bf Pointer to a BollieStereoFilter object.
+*/
+void bf_stereo_init(BollieStereoFilter* bf) {
+    const bf_frame zero = {0, 0};
+    for (unsigned int i = 0 ; i < 2 ; ++i) {
+        bf->in_buf[i] = zero;
+        bf->processed_buf[i] = zero;
+    }
+    bf->fill_count = 0;
+    bf->freq = 0;
+    bf->Q = 0;
+    bf->tgt_freq = 0;
+    bf->tgt_Q = 0;
+    bf->high = 0;
+}
+
+
+/**
+* Resets a BollieStereoFilter object.
+*/
+void bf_stereo_reset(BollieStereoFilter* bf) {
+    bf_stereo_init(bf);
+}
+
+
+/**
+* Recalculates the coefficients of a stereo filter from its current
+* parameters.
+* \param bf     Pointer to the BollieStereoFilter object
+*/
+static void bf_stereo_update(BollieStereoFilter* bf) {
+    float c[5];
+    if (bf->high)
+        calc_hcf(bf->freq, bf->Q, bf->rate, c);
+    else
+        calc_lcf(bf->freq, bf->Q, bf->rate, c);
+    bf->b0 = c[0];
+    bf->b1 = c[1];
+    bf->b2 = c[2];
+    bf->a1 = c[3];
+    bf->a2 = c[4];
+}
+
+
+/**
+* Sets the parameters a stereo filter glides to. A freshly reset filter,
+* a new rate or a new filter type take effect right away instead.
 * \param freq   Filter cut off frequency
 * \param Q      Filter quality
 * \param rate   Current sampling rate
-* \param bf     Pointer to the BollieFilter object
-* \return       Output sample
+* \param high   Nonzero for a high cut filter
+* \param bf     Pointer to the BollieStereoFilter object
 */
-float bf_hcf(const float in, const float freq, const float Q, 
-    double rate, BollieFilter* bf) {
+static void bf_stereo_set(const float freq, const float Q, double rate,
+    int high, BollieStereoFilter* bf) {
 
-    // Precalculate if needed.
-    if (freq != bf->freq || Q != bf->Q || rate != bf->rate) {
+    bf->tgt_freq = freq;
+    bf->tgt_Q = Q;
+    if (rate != bf->rate || high != bf->high || bf->freq == 0) {
+        bf->rate = rate;
+        bf->high = high;
+        bf->glide = expf(-BF_BLOCK / (BF_GLIDE_TIME * rate));
         bf->freq = freq;
         bf->Q = Q;
-        bf->rate = rate;
-        float w0 = 2 * PI * bf->freq / bf->rate;
-        float alpha = sin(w0) / (2*bf->Q);
-        bf->a0 = 1+alpha;
-        bf->a1 = -2 * cos(w0);
-        bf->a2 = 1-alpha;
-        bf->b0 = (1 - cos(w0)) / 2;
-        bf->b1 = 1 - cos(w0);
-        bf->b2 = (1 - cos(w0)) / 2; 
+        bf_stereo_update(bf);
     }
+}
 
-    // Filter roll
-    bf->in_buf[2] = bf->in_buf[1];
-    bf->in_buf[1] = bf->in_buf[0];
-    bf->in_buf[0] = in;
 
-    bf->processed_buf[2] = bf->processed_buf[1];
-    bf->processed_buf[1] = bf->processed_buf[0];
+/**
+* Moves the parameters of a stereo filter one step towards their targets
+* and recalculates the coefficients if they changed.
+* \param bf     Pointer to the BollieStereoFilter object
+*/
+static void bf_stereo_glide(BollieStereoFilter* bf) {
+    if (bf->freq == bf->tgt_freq && bf->Q == bf->tgt_Q)
+        return;
 
-    // See if we need to fill the buffers first
+    bf->freq = bf->tgt_freq + (bf->freq - bf->tgt_freq) * bf->glide;
+    bf->Q = bf->tgt_Q + (bf->Q - bf->tgt_Q) * bf->glide;
+    // Snap once the remaining step is well below audible
+    if (fabsf(bf->freq - bf->tgt_freq) < 1e-3f * bf->tgt_freq)
+        bf->freq = bf->tgt_freq;
+    if (fabsf(bf->Q - bf->tgt_Q) < 1e-3f * bf->tgt_Q)
+        bf->Q = bf->tgt_Q;
+    bf_stereo_update(bf);
+}
+
+
+/**
+* Sets up a BollieStereoFilter object as low cut filter.
+* Parameter changes glide in over about BF_GLIDE_TIME while processing.
+* \param freq   Filter cut off frequency
+* \param Q      Filter quality
+* \param rate   Current sampling rate
+* \param bf     Pointer to the BollieStereoFilter object
+*/
+void bf_stereo_set_lcf(const float freq, const float Q, double rate, 
+    BollieStereoFilter* bf) {
+
+    bf_stereo_set(freq, Q, rate, 0, bf);
+}
+
+
+/**
+* Sets up a BollieStereoFilter object as high cut filter.
+* Parameter changes glide in over about BF_GLIDE_TIME while processing.
+* \param freq   Filter cut off frequency
+* \param Q      Filter quality
+* \param rate   Current sampling rate
+* \param bf     Pointer to the BollieStereoFilter object
+*/
+void bf_stereo_set_hcf(const float freq, const float Q, double rate, 
+    BollieStereoFilter* bf) {
+
+    bf_stereo_set(freq, Q, rate, 1, bf);
+}
+
+
+/**
+* Processes one frame while the buffers of a stereo filter are filling.
+* \param in     Input frame
+* \param bf     Pointer to the BollieStereoFilter object
+* \return       Output frame
+*/
+static bf_frame bf_stereo_fill(bf_frame in, BollieStereoFilter* bf) {
     if (bf->fill_count < 3) {
+        const bf_frame zero = {0, 0};
+        bf->in_buf[1] = bf->in_buf[0];
+        bf->in_buf[0] = in;
+        bf->processed_buf[1] = bf->processed_buf[0];
         bf->processed_buf[0] = in;
         bf->fill_count++;
-        return 0;
+        return zero;
     }
 
-    return bf->processed_buf[0] =             
-            (bf->b0 / bf->a0 * bf->in_buf[0]) +
-            (bf->b1 / bf->a0 * bf->in_buf[1]) +
-            (bf->b2 / bf->a0 * bf->in_buf[2]) -
-            (bf->a1 / bf->a0 * bf->processed_buf[1]) -
-            (bf->a2 / bf->a0 * bf->processed_buf[2]);
+    const bf_frame y = bf->b0 * in + bf->b1 * bf->in_buf[0] 
+        + bf->b2 * bf->in_buf[1] - bf->a1 * bf->processed_buf[0] 
+        - bf->a2 * bf->processed_buf[1];
+    bf->in_buf[1] = bf->in_buf[0];
+    bf->in_buf[0] = in;
+    bf->processed_buf[1] = bf->processed_buf[0];
+    bf->processed_buf[0] = y;
+    return y;
 }
 
+
+/**
+* Processes a stereo block in place through one or two cascaded filters.
+* Both channels are computed together, so the cascade costs about as much
+* as a single mono filter.
+* \param buf_l  Left samples to filter
+* \param buf_r  Right samples to filter
+* \param n      Number of samples
+* \param first  First filter stage
+* \param second Second filter stage or NULL
+*/
+void bf_stereo_process(float* buf_l, float* buf_r, unsigned int n, 
+    BollieStereoFilter* first, BollieStereoFilter* second) {
+
+    unsigned int i = 0;
+
+    // See if we need to fill the buffers first
+    for (; i < n && (first->fill_count < 3 || 
+            (second && second->fill_count < 3)) ; ++i) {
+        bf_frame f = {buf_l[i], buf_r[i]};
+        f = bf_stereo_fill(f, first);
+        if (second)
+            f = bf_stereo_fill(f, second);
+        buf_l[i] = f[0];
+        buf_r[i] = f[1];
+    }
+
+    bf_frame x1 = first->in_buf[0];
+    bf_frame x2 = first->in_buf[1];
+    bf_frame y1 = first->processed_buf[0];
+    bf_frame y2 = first->processed_buf[1];
+
+    if (!second) {
+        while (i < n) {
+            // Coefficients only change between sub-blocks
+            bf_stereo_glide(first);
+            const float b0 = first->b0;
+            const float b1 = first->b1;
+            const float b2 = first->b2;
+            const float a1 = first->a1;
+            const float a2 = first->a2;
+            const unsigned int end = n - i > BF_BLOCK ? i + BF_BLOCK : n;
+
+            for (; i < end ; ++i) {
+                const bf_frame x0 = {buf_l[i], buf_r[i]};
+                const bf_frame y0 = b0 * x0 + b1 * x1 + b2 * x2 
+                    - a1 * y1 - a2 * y2;
+                x2 = x1;
+                x1 = x0;
+                y2 = y1;
+                y1 = y0;
+                buf_l[i] = y0[0];
+                buf_r[i] = y0[1];
+            }
+        }
+    }
+    else {
+        bf_frame w1 = second->in_buf[0];
+        bf_frame w2 = second->in_buf[1];
+        bf_frame z1 = second->processed_buf[0];
+        bf_frame z2 = second->processed_buf[1];
+
+        while (i < n) {
+            bf_stereo_glide(first);
+            bf_stereo_glide(second);
+            const float b0 = first->b0;
+            const float b1 = first->b1;
+            const float b2 = first->b2;
+            const float a1 = first->a1;
+            const float a2 = first->a2;
+            const float d0 = second->b0;
+            const float d1 = second->b1;
+            const float d2 = second->b2;
+            const float c1 = second->a1;
+            const float c2 = second->a2;
+            const unsigned int end = n - i > BF_BLOCK ? i + BF_BLOCK : n;
+
+            for (; i < end ; ++i) {
+                const bf_frame x0 = {buf_l[i], buf_r[i]};
+                const bf_frame y0 = b0 * x0 + b1 * x1 + b2 * x2 
+                    - a1 * y1 - a2 * y2;
+                // The output of the first stage feeds the second one
+                const bf_frame z0 = d0 * y0 + d1 * w1 + d2 * w2 
+                    - c1 * z1 - c2 * z2;
+                x2 = x1;
+                x1 = x0;
+                y2 = y1;
+                y1 = y0;
+                w2 = w1;
+                w1 = y0;
+                z2 = z1;
+                z1 = z0;
+                buf_l[i] = z0[0];
+                buf_r[i] = z0[1];
+            }
+        }
+        second->in_buf[0] = w1;
+        second->in_buf[1] = w2;
+        second->processed_buf[0] = z1;
+        second->processed_buf[1] = z2;
+    }
+
+    first->in_buf[0] = x1;
+    first->in_buf[1] = x2;
+    first->processed_buf[0] = y1;
+    first->processed_buf[1] = y2;
+}
+
+
+/**
+* Processes a frame using a low cut filter.
+* \param in     Input sample
+* \param freq   Filter cut off frequency
+* \param Q      Filter quality
+* \param rate   Current sampling rate
+* \param bf     Pointer to the BollieFilter object
+* \return       Output sample
+* \todo         Validating parameters
+*/
+float bf_lcf(const float in, const float freq, const float Q, 
+    double rate, BollieFilter* bf) {
+
+    float out = in;
+    bf_set_lcf(freq, Q, rate, bf);
+    bf_process(&out, 1, bf);
+    return out;
+}
+
+
+/**
+* Processes a frame using a high cut filter.
+* \param in     Input sample
+* \param freq   Filter cut off frequency
+* \param Q      Filter quality
+* \param rate   Current sampling rate
+* \param bf     Pointer to the BollieFilter object
+* \return       Output sample
+*/
+float bf_hcf(const float in, const float freq, const float Q, 
+    double rate, BollieFilter* bf) {
+
+    float out = in;
+    bf_set_hcf(freq, Q, rate, bf);
+    bf_process(&out, 1, bf);
+    return out;
+}
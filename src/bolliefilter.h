@@ -28,6 +28,9 @@
 #define __BOLLIEFILTER_H__
 
 #define PI 3.141592
+#define BF_BLOCK 16             ///< samples between stereo coefficient updates
+#define BF_GLIDE_TIME 0.02      ///< time constant of parameter sweeps in s
+#define BF_MAX_FREQ 0.45        ///< highest cut off frequency, times the rate
 
 /**
 * Filter struct
@@ -36,8 +39,7 @@ typedef struct bfilter {
     double  rate;               ///< Current sampling rate
     float   freq;               ///< cut off frequency
     float   Q;                  ///< filter quality
-    float   a0;
-    float   a1;
+    float   a1;                 ///< coefficients, normalized by a0
     float   a2;
     float   b0;
     float   b1;
@@ -47,8 +49,54 @@ typedef struct bfilter {
     unsigned int fill_count;    ///< fill count for the buffers
 } BollieFilter;
 
+/**
+* One stereo frame, left channel in lane 0 and right channel in lane 1.
+* The compiler keeps it in a single SSE/NEON register.
+*/
+typedef float bf_frame __attribute__((vector_size(8)));
+
+/**
+* Stereo filter struct, both channels share the same parameters
+*/
+typedef struct bsfilter {
+    double  rate;               ///< Current sampling rate
+    float   freq;               ///< cut off frequency
+    float   Q;                  ///< filter quality
+    float   tgt_freq;           ///< cut off frequency the filter glides to
+    float   tgt_Q;              ///< filter quality the filter glides to
+    float   glide;              ///< glide factor per BF_BLOCK samples
+    int     high;               ///< set up as high cut filter
+    float   a1;                 ///< coefficients, normalized by a0
+    float   a2;
+    float   b0;
+    float   b1;
+    float   b2;
+    bf_frame in_buf[2];         ///< last incoming frames
+    bf_frame processed_buf[2];  ///< last frames processed by this filter
+    unsigned int fill_count;    ///< fill count for the buffers
+} BollieStereoFilter;
+
 void bf_init(BollieFilter*);
 void bf_reset(BollieFilter*); 
+void bf_set_lcf(const float freq, const float Q, double rate, 
+    BollieFilter* bf);
+
+void bf_set_hcf(const float freq, const float Q, double rate, 
+    BollieFilter* bf);
+
+void bf_process(float* buf, unsigned int n, BollieFilter* bf);
+
+void bf_stereo_init(BollieStereoFilter*);
+void bf_stereo_reset(BollieStereoFilter*);
+void bf_stereo_set_lcf(const float freq, const float Q, double rate, 
+    BollieStereoFilter* bf);
+
+void bf_stereo_set_hcf(const float freq, const float Q, double rate, 
+    BollieStereoFilter* bf);
+
+void bf_stereo_process(float* buf_l, float* buf_r, unsigned int n, 
+    BollieStereoFilter* first, BollieStereoFilter* second);
+
 float bf_lcf(const float in, const float freq, const float Q, 
     double rate, BollieFilter* bf); 
 
@@ -0,0 +1,225 @@
+/**
+    Bollie Delay - (c) 2016 Thomas Ebeling https://ca9.eu
+
+    This file is part of bolliedelay.lv2
+
+    This is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This code is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+* \file bollieresample.c
+* \author Bollie (https://ca9.eu)
+* \brief Stereo half-band decimation and interpolation by 2 or 4.
+*
+* Every stage halves the rate with a polyphase IIR half-band filter: two
+* paths of first-order allpass sections in z^2, so both paths run at the
+* lower rate. Six sections give a passband up to 0.44 of the lower rate and
+* about 85 dB stopband attenuation (elliptic design after Valenzuela and
+* Constantinides, transition band 0.06). The phase isn't linear, which
+* doesn't matter for the repeats of a delay.
+* br_up() takes what the br_down() before it returned. Going up, every stage
+* is one sample of its higher rate late, so it produces exactly as many
+* samples as went down for any block length.
+*/
+
+#include "bollieresample.h"
+#include <string.h>
+
+/**
+* Allpass coefficients, the even ones form the first path, the odd ones the
+* second path. Each section of the first path runs next to one of the second.
+*/
+static const br_quad br_coeffs[BR_COEFS / 2] = {
+    {0.054217526f, 0.054217526f, 0.196797970f, 0.196797970f},
+    {0.383087327f, 0.383087327f, 0.573136411f, 0.573136411f},
+    {0.748720944f, 0.748720944f, 0.914293710f, 0.914293710f},
+};
+
+/**
+* Runs two frames through both paths at once.
+* \param x input frames, one per path
+* \param in last input of each section
+* \param out last output of each section
+* \return output frames of both paths
+*/
+static inline br_quad br_paths(br_quad x, br_quad* in, br_quad* out) {
+    for (unsigned int i = 0 ; i < BR_COEFS / 2 ; ++i) {
+        const br_quad y = (x - out[i]) * br_coeffs[i] + in[i];
+        in[i] = x;
+        out[i] = y;
+        x = y;
+    }
+    return x;
+}
+
+/**
+* Halves the rate of a block with one stage. Works in place.
+* \return number of output samples
+*/
+static unsigned int br_stage_down(BollieHalfband* hb, const float* in_l,
+    const float* in_r, unsigned int n, float* out_l, float* out_r) {
+
+    // The state stays in registers during the block
+    br_quad in[BR_COEFS / 2];
+    br_quad out[BR_COEFS / 2];
+    memcpy(in, hb->down_x, sizeof(in));
+    memcpy(out, hb->down_y, sizeof(out));
+
+    // The later sample of a pair takes the first path
+    unsigned int i = 0;
+    unsigned int k = 0;
+    if (hb->n_held && n) {
+        const br_quad x = {in_l[0], in_r[0], hb->held[0], hb->held[1]};
+        const br_quad y = br_paths(x, in, out);
+        out_l[0] = 0.5f * (y[0] + y[2]);
+        out_r[0] = 0.5f * (y[1] + y[3]);
+        i = 1;
+        k = 1;
+    }
+    for (; i + 1 < n ; i += 2, ++k) {
+        const br_quad x = {in_l[i + 1], in_r[i + 1], in_l[i], in_r[i]};
+        const br_quad y = br_paths(x, in, out);
+        out_l[k] = 0.5f * (y[0] + y[2]);
+        out_r[k] = 0.5f * (y[1] + y[3]);
+    }
+    if (i < n) {
+        hb->held[0] = in_l[i];
+        hb->held[1] = in_r[i];
+        hb->n_held = 1;
+    }
+    else if (n) {
+        hb->n_held = 0;
+    }
+
+    memcpy(hb->down_x, in, sizeof(in));
+    memcpy(hb->down_y, out, sizeof(out));
+    hb->n_in = n;
+    hb->n_out = k;
+    return k;
+}
+
+/**
+* Doubles the rate of a block with one stage, producing as many samples as
+* the last br_stage_down() took.
+*/
+static void br_stage_up(BollieHalfband* hb, const float* in_l,
+    const float* in_r, float* out_l, float* out_r) {
+
+    const unsigned int n = hb->n_out;
+    const unsigned int n_out = hb->n_in;
+    br_quad in[BR_COEFS / 2];
+    br_quad out[BR_COEFS / 2];
+    memcpy(in, hb->up_x, sizeof(in));
+    memcpy(out, hb->up_y, sizeof(out));
+
+    unsigned int j = 0;
+    if (hb->n_carry) {
+        out_l[0] = hb->carry[0];
+        out_r[0] = hb->carry[1];
+        j = 1;
+    }
+    hb->n_carry = 0;
+
+    // The first path gives the earlier output sample
+    for (unsigned int i = 0 ; i < n ; ++i) {
+        const br_quad x = {in_l[i], in_r[i], in_l[i], in_r[i]};
+        const br_quad y = br_paths(x, in, out);
+        out_l[j] = y[0];
+        out_r[j] = y[1];
+        ++j;
+        if (j < n_out) {
+            out_l[j] = y[2];
+            out_r[j] = y[3];
+            ++j;
+        }
+        else {
+            hb->carry[0] = y[2];
+            hb->carry[1] = y[3];
+            hb->n_carry = 1;
+        }
+    }
+
+    memcpy(hb->up_x, in, sizeof(in));
+    memcpy(hb->up_y, out, sizeof(out));
+}
+
+/**
+* Initializes a BollieResampler object.
+* \param rs     Pointer to a BollieResampler object
+* \param factor Decimation factor, 1, 2 or 4
+*/
+void br_init(BollieResampler* rs, unsigned int factor) {
+    rs->stages = factor >= 4 ? 2 : factor >= 2 ? 1 : 0;
+    br_reset(rs);
+}
+
+/**
+* Resets a BollieResampler object to silence.
+*/
+void br_reset(BollieResampler* rs) {
+    memset(rs->stage, 0, sizeof(rs->stage));
+    for (unsigned int s = 0 ; s < BR_STAGES ; ++s)
+        rs->stage[s].n_carry = 1;
+}
+
+/**
+* Decimates a block of both channels. Works in place.
+* \param rs     Pointer to the BollieResampler object
+* \param in_l   Input samples, left channel
+* \param in_r   Input samples, right channel
+* \param n      Number of input samples, at most BR_CHUNK
+* \param out_l  Output samples, left channel
+* \param out_r  Output samples, right channel
+* \return number of output samples, depends on the samples held over from
+*   the last block
+*/
+unsigned int br_down(BollieResampler* rs, const float* in_l,
+    const float* in_r, unsigned int n, float* out_l, float* out_r) {
+
+    if (!rs->stages) {
+        memmove(out_l, in_l, n * sizeof(float));
+        memmove(out_r, in_r, n * sizeof(float));
+        rs->stage[0].n_in = n;
+        return n;
+    }
+    n = br_stage_down(&rs->stage[0], in_l, in_r, n, out_l, out_r);
+    for (unsigned int s = 1 ; s < rs->stages ; ++s)
+        n = br_stage_down(&rs->stage[s], out_l, out_r, n, out_l, out_r);
+    return n;
+}
+
+/**
+* Interpolates the block of the last br_down() back to the full rate.
+* \param rs     Pointer to the BollieResampler object
+* \param in_l   Samples returned by the last br_down(), left channel
+* \param in_r   Samples returned by the last br_down(), right channel
+* \param out_l  Output samples, as many as went into br_down()
+* \param out_r  Output samples, right channel
+*/
+void br_up(BollieResampler* rs, const float* in_l, const float* in_r,
+    float* out_l, float* out_r) {
+
+    const unsigned int stages = rs->stages;
+    if (!stages) {
+        memmove(out_l, in_l, rs->stage[0].n_in * sizeof(float));
+        memmove(out_r, in_r, rs->stage[0].n_in * sizeof(float));
+        return;
+    }
+    for (unsigned int s = stages - 1 ; s > 0 ; --s) {
+        br_stage_up(&rs->stage[s], in_l, in_r, rs->mid[0], rs->mid[1]);
+        in_l = rs->mid[0];
+        in_r = rs->mid[1];
+    }
+    br_stage_up(&rs->stage[0], in_l, in_r, out_l, out_r);
+}
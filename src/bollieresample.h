@@ -0,0 +1,73 @@
+/**
+    Bollie Delay - (c) 2016 Thomas Ebeling https://ca9.eu
+
+    This file is part of bolliedelay.lv2
+
+    This is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This code is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+* \file bollieresample.h
+* \author Bollie (https://ca9.eu)
+* \brief Stereo half-band decimation and interpolation by 2 or 4.
+*/
+
+#ifndef __BOLLIERESAMPLE_H__
+#define __BOLLIERESAMPLE_H__
+
+#define BR_COEFS 6              ///< allpass sections of a half-band stage
+#define BR_STAGES 2             ///< half-band stages, decimation by up to 4
+#define BR_CHUNK 256            ///< most samples per br_down() call
+
+/**
+* Both paths of a stage side by side, a stereo frame for the first path in
+* lanes 0 and 1 and one for the second path in lanes 2 and 3.
+*/
+typedef float br_quad __attribute__((vector_size(16)));
+
+/**
+* One half-band stage down and back up, for both channels
+*/
+typedef struct bhalfband {
+    br_quad down_x[BR_COEFS / 2];   ///< last input of each section, going down
+    br_quad down_y[BR_COEFS / 2];   ///< last output of each section, going down
+    br_quad up_x[BR_COEFS / 2];     ///< last input of each section, going up
+    br_quad up_y[BR_COEFS / 2];     ///< last output of each section, going up
+    float   held[2];                ///< even input frame waiting for its pair
+    float   carry[2];               ///< interpolated frame due next call
+    unsigned int n_held;            ///< 1 if held is waiting
+    unsigned int n_carry;           ///< 1 if carry is due
+    unsigned int n_in;              ///< input samples of the last br_down()
+    unsigned int n_out;             ///< output samples of the last br_down()
+} BollieHalfband;
+
+/**
+* Resampler for a wet path running at a fraction of the sample rate
+*/
+typedef struct bresampler {
+    unsigned int stages;            ///< active stages, log2 of the factor
+    BollieHalfband stage[BR_STAGES];
+    float   mid[2][BR_CHUNK / 2 + 1]; ///< samples between two stages
+} BollieResampler;
+
+void br_init(BollieResampler* rs, unsigned int factor);
+void br_reset(BollieResampler* rs);
+
+unsigned int br_down(BollieResampler* rs, const float* in_l,
+    const float* in_r, unsigned int n, float* out_l, float* out_r);
+
+void br_up(BollieResampler* rs, const float* in_l, const float* in_r,
+    float* out_l, float* out_r);
+
+#endif
@@ -0,0 +1,251 @@
+/**
+    Bollie Delay - (c) 2016 Thomas Ebeling https://ca9.eu
+
+    This file is part of bolliedelay.lv2
+
+    This is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This code is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+* \file bollietape.c
+* \author Bollie (https://ca9.eu)
+* \brief Process-wide pool for delay tapes.
+*
+* Tapes are handed out in power-of-two size classes. A released tape is kept
+* in the pool of its class, so other instances in the same process reuse it
+* instead of asking the OS for new pages. Without TAPE_POOL, every tape is
+* a plain aligned allocation of the requested size.
+* With TAPE_LOCKED, tapes are mapped directly, backed by transparent huge
+* pages where the kernel offers them, locked into memory and faulted in
+* before they are handed out. run() then never takes a page fault on the
+* tape.
+* Allocation and release are not real-time safe, they belong to
+* instantiate(), cleanup() and the worker.
+*/
+
+#include "bollietape.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef TAPE_LOCKED
+#include <sys/mman.h>
+
+/**
+* Size of a huge page, the mappings are aligned to it
+*/
+#define BT_HUGE_PAGE ((size_t)2 << 20)
+
+/**
+* Size of a small page
+*/
+#define BT_PAGE ((size_t)4096)
+
+/**
+* Mapped length of a block, whole small pages.
+*/
+static size_t bt_map_len(size_t size) {
+    return (size + BT_PAGE - 1) & ~(BT_PAGE - 1);
+}
+
+/**
+* Maps a block of memory for a tape. The mapping is aligned to a huge page,
+* so transparent huge pages can back all of it. Every page is resident
+* before this returns, locked if the memlock limit allows it.
+* \param size   Size in bytes
+* \return pointer to the block or NULL
+*/
+static void* bt_map(size_t size) {
+    const size_t len = bt_map_len(size);
+    char* mem = (char*)mmap(NULL, len + BT_HUGE_PAGE, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+        return NULL;
+
+    // Trim the mapping to the aligned block
+    char* start = (char*)(((uintptr_t)mem + BT_HUGE_PAGE - 1) 
+        & ~(uintptr_t)(BT_HUGE_PAGE - 1));
+    if (start > mem)
+        munmap(mem, start - mem);
+    munmap(start + len, mem + BT_HUGE_PAGE - start);
+
+#ifdef MADV_HUGEPAGE
+    madvise(start, len, MADV_HUGEPAGE);
+#endif
+    // mlock() faults the pages in, without it every page is touched once
+    if (mlock(start, len)) {
+        for (size_t i = 0 ; i < len ; i += BT_PAGE)
+            ((volatile char*)start)[i] = 0;
+    }
+    return start;
+}
+
+/**
+* Unmaps a block from bt_map().
+* \param mem    Block
+* \param size   Size in bytes as given to bt_map()
+*/
+static void bt_unmap(void* mem, size_t size) {
+    munmap(mem, bt_map_len(size));
+}
+
+#else
+
+/**
+* Allocates a block of memory for a tape, aligned to BT_ALIGN.
+* \param size   Size in bytes
+* \return pointer to the block or NULL
+*/
+static void* bt_map(size_t size) {
+    void* mem = NULL;
+    if (posix_memalign(&mem, BT_ALIGN, size))
+        return NULL;
+    return mem;
+}
+
+/**
+* Frees a block from bt_map().
+*/
+static void bt_unmap(void* mem, size_t size) {
+    free(mem);
+}
+
+#endif
+
+#ifdef TAPE_POOL
+#include <pthread.h>
+
+/**
+* Smallest size class, 2^16 bytes
+*/
+#define BT_MIN_CLASS 16
+
+/**
+* Number of size classes, the biggest one is 2^31 bytes
+*/
+#define BT_CLASSES 16
+
+/**
+* Released tapes kept per size class, more go back to the OS
+*/
+#define BT_KEEP 4
+
+/**
+* Header in front of every pooled tape. It fills a whole cache line, so the
+* tape behind it stays aligned.
+*/
+typedef union btape {
+    struct {
+        union btape* next;      ///< next released tape of the same class
+        unsigned int cls;       ///< size class
+    };
+    char pad[BT_ALIGN];
+} BollieTape;
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static BollieTape* pool[BT_CLASSES];        ///< released tapes per class
+static unsigned int pool_count[BT_CLASSES]; ///< number of released tapes
+
+/**
+* Allocates a tape. The memory is aligned to BT_ALIGN and not cleared.
+* \param size   Requested size in bytes
+* \param actual Receives the usable size in bytes, at least size
+* \return pointer to the tape or NULL
+*/
+void* bt_alloc(size_t size, size_t* actual) {
+    unsigned int cls = BT_MIN_CLASS;
+    while (cls < BT_MIN_CLASS + BT_CLASSES - 1 && ((size_t)1 << cls) < size)
+        ++cls;
+    if (((size_t)1 << cls) < size)
+        return NULL;
+
+    pthread_mutex_lock(&pool_lock);
+    BollieTape* t = pool[cls - BT_MIN_CLASS];
+    if (t) {
+        pool[cls - BT_MIN_CLASS] = t->next;
+        --pool_count[cls - BT_MIN_CLASS];
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    if (!t) {
+        t = (BollieTape*)bt_map(sizeof(BollieTape) + ((size_t)1 << cls));
+        if (!t)
+            return NULL;
+        t->cls = cls;
+    }
+    t->next = NULL;
+    *actual = (size_t)1 << cls;
+    return t + 1;
+}
+
+/**
+* Releases a tape to the pool.
+* \param tape Tape from bt_alloc() or NULL
+*/
+void bt_free(void* tape) {
+    if (!tape)
+        return;
+
+    BollieTape* t = (BollieTape*)tape - 1;
+    const unsigned int i = t->cls - BT_MIN_CLASS;
+    pthread_mutex_lock(&pool_lock);
+    if (pool_count[i] < BT_KEEP) {
+        t->next = pool[i];
+        pool[i] = t;
+        ++pool_count[i];
+        t = NULL;
+    }
+    pthread_mutex_unlock(&pool_lock);
+    if (t)
+        bt_unmap(t, sizeof(BollieTape) + ((size_t)1 << t->cls));
+}
+
+#else
+
+/**
+* Header in front of every tape, it keeps the size for the release. It fills
+* a whole cache line, so the tape behind it stays aligned.
+*/
+typedef union btape {
+    size_t size;                ///< usable size in bytes
+    char pad[BT_ALIGN];
+} BollieTape;
+
+/**
+* Allocates a tape. The memory is aligned to BT_ALIGN and not cleared.
+* \param size   Requested size in bytes
+* \param actual Receives the usable size in bytes, the requested one
+* \return pointer to the tape or NULL
+*/
+void* bt_alloc(size_t size, size_t* actual) {
+    BollieTape* t = (BollieTape*)bt_map(sizeof(BollieTape) + size);
+    if (!t)
+        return NULL;
+    t->size = size;
+    *actual = size;
+    return t + 1;
+}
+
+/**
+* Releases a tape.
+* \param tape Tape from bt_alloc() or NULL
+*/
+void bt_free(void* tape) {
+    if (!tape)
+        return;
+
+    BollieTape* t = (BollieTape*)tape - 1;
+    bt_unmap(t, sizeof(BollieTape) + t->size);
+}
+
+#endif
@@ -0,0 +1,39 @@
+/**
+    Bollie Delay - (c) 2016 Thomas Ebeling https://ca9.eu
+
+    This file is part of bolliedelay.lv2
+
+    This is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This code is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+* \file bollietape.h
+* \author Bollie (https://ca9.eu)
+* \brief Process-wide pool for delay tapes.
+*/
+
+#ifndef __BOLLIETAPE_H__
+#define __BOLLIETAPE_H__
+
+#include <stddef.h>
+
+/**
+* Alignment of every tape in bytes, a cache line.
+*/
+#define BT_ALIGN 64
+
+void* bt_alloc(size_t size, size_t* actual);
+void bt_free(void* tape);
+
+#endif